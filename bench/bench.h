@@ -0,0 +1,201 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace coreds {
+namespace bench {
+
+inline int64_t nanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * --name=value arguments.
+ */
+struct Args
+{
+    int argc;
+    char** argv;
+    
+    const char* get(const char* name, const char* def = nullptr) const
+    {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; i++)
+        {
+            const char* a = argv[i];
+            if (0 == std::strncmp(a, "--", 2) && 0 == std::strncmp(a + 2, name, len) && '=' == a[2 + len])
+                return a + 3 + len;
+        }
+        return def;
+    }
+    
+    int64_t getInt(const char* name, int64_t def) const
+    {
+        const char* v = get(name);
+        return v ? std::strtoll(v, nullptr, 10) : def;
+    }
+    
+    /**
+     * Comma-separated integers.
+     */
+    std::vector<int64_t> getList(const char* name, const char* def) const
+    {
+        std::vector<int64_t> list;
+        std::string str(get(name, def));
+        for (size_t pos = 0, comma; pos < str.size(); pos = comma + 1)
+        {
+            if (std::string::npos == (comma = str.find(',', pos)))
+                comma = str.size();
+            
+            list.push_back(std::strtoll(str.c_str() + pos, nullptr, 10));
+        }
+        return list;
+    }
+};
+
+struct Timing
+{
+    uint64_t iterations{ 0 };
+    // only the timed part of each iteration
+    int64_t total_ns{ 0 };
+    int64_t min_ns{ 0 };
+    int64_t max_ns{ 0 };
+    
+    double mean() const
+    {
+        return iterations == 0 ? 0 : static_cast<double>(total_ns) / iterations;
+    }
+};
+
+/**
+ * Runs op until it was timed for min_time_ns (and at least min_iterations),
+ * or until max_wall_ns elapsed including the untimed setup.
+ * op does its own setup and returns the nanos it timed.
+ */
+inline Timing run(const std::function<int64_t()>& op,
+        int64_t min_time_ns = 200000000,
+        int64_t max_wall_ns = 2000000000,
+        uint64_t min_iterations = 3)
+{
+    Timing t;
+    int64_t start = nanos();
+    do
+    {
+        int64_t ns = op();
+        if (t.iterations == 0 || ns < t.min_ns)
+            t.min_ns = ns;
+        if (ns > t.max_ns)
+            t.max_ns = ns;
+        
+        t.total_ns += ns;
+        t.iterations++;
+    }
+    while (t.iterations < min_iterations ||
+            (t.total_ns < min_time_ns && nanos() - start < max_wall_ns));
+    
+    return t;
+}
+
+/**
+ * Collects results as a json document: {"bench":name,"params":{...},"results":[...]}
+ */
+struct Report
+{
+    std::string params;
+    std::string results;
+    
+    void param(const char* name, const std::string& value, bool quote = true)
+    {
+        params += params.empty() ? "\"" : ",\"";
+        params += name;
+        params += "\":";
+        if (quote)
+            params += '"';
+        params += value;
+        if (quote)
+            params += '"';
+    }
+    
+    /**
+     * fields is a json fragment (e.g "size":100,"ratio":0.5), items the units processed per op.
+     */
+    void add(const char* op, const std::string& fields, const Timing& t, double items = 1, double bytes = 0)
+    {
+        double mean = t.mean();
+        
+        results += results.empty() ? "{" : ",{";
+        results += "\"op\":\"";
+        results += op;
+        results += '"';
+        if (!fields.empty())
+        {
+            results += ',';
+            results += fields;
+        }
+        results += ",\"iterations\":";
+        results += std::to_string(t.iterations);
+        results += ",\"ns_per_op\":";
+        results += std::to_string(mean);
+        results += ",\"min_ns\":";
+        results += std::to_string(t.min_ns);
+        results += ",\"max_ns\":";
+        results += std::to_string(t.max_ns);
+        if (mean != 0)
+        {
+            results += ",\"items_per_sec\":";
+            results += std::to_string(items * 1e9 / mean);
+            if (bytes != 0)
+            {
+                results += ",\"bytes_per_sec\":";
+                results += std::to_string(bytes * 1e9 / mean);
+            }
+        }
+        results += '}';
+        
+        // progress on stderr, the report goes to stdout (or --out)
+        std::fprintf(stderr, "%-24s %-40s %14.1f ns/op\n", op, fields.c_str(), mean);
+    }
+    
+    bool write(const char* bench, const char* path = nullptr)
+    {
+        std::string buf("{\"bench\":\"");
+        buf += bench;
+        buf += "\",\"params\":{";
+        buf += params;
+        buf += "},\"results\":[";
+        buf += results;
+        buf += "]}\n";
+        
+        FILE* f = path ? std::fopen(path, "w") : stdout;
+        if (f == nullptr)
+            return false;
+        
+        bool ok = buf.size() == std::fwrite(buf.data(), 1, buf.size(), f);
+        if (path)
+            std::fclose(f);
+        
+        return ok;
+    }
+};
+
+/**
+ * Keeps the optimizer from discarding a result.
+ */
+template <typename T>
+inline void consume(T value)
+{
+    static volatile T sink;
+    sink = value;
+    (void)sink;
+}
+
+} // bench
+} // coreds
@@ -0,0 +1,439 @@
+// b64, appendJsonStrTo and MultiCAS::stringifyTo over realistic corpora,
+// with allocations per op counted by the operator new below.
+//
+// codec_bench [--variant=baseline] [--min_ms=200] [--seed=1] [--out=results.json]
+//
+// With a recording (see rpc::Recorder), its responses are also parsed with the Parser and the Transcoder,
+// and every transcoded message is compared byte for byte with the Parser's (exits with 1 on a mismatch):
+// codec_bench --recording=traffic.rec --schema=app.bfbs --root=Todo_PList [--uri=/todo/user/Todo/list]
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+#include <coreds/b64.h>
+#include <coreds/mc.h>
+#include <coreds/zip.h>
+#include <coreds/record.h>
+#include <coreds/schema.h>
+#include <coreds/transcode.h>
+
+#include "bench.h"
+
+using namespace coreds;
+
+namespace {
+
+std::atomic<uint64_t> alloc_count{ 0 };
+std::atomic<uint64_t> alloc_bytes{ 0 };
+
+} // namespace
+
+void* operator new(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+/**
+ * The implementations under test. Add an optimized variant as another entry,
+ * and select it with --variant=name to compare against baseline in the same binary.
+ */
+struct Variant
+{
+    const char* name;
+    std::function<std::string(const void* data, size_t len)> encode;
+    std::function<int(char* out, const char* in, int len)> encodeTo;
+    std::function<std::string(const void* data, size_t len)> decode;
+    std::function<void(std::string& text, const std::string& src)> appendJsonStrTo;
+    std::function<void(MultiCAS& mc, std::string& buf)> stringifyTo;
+};
+
+const Variant VARIANTS[] = {
+    {
+        "baseline",
+        [](const void* data, size_t len) { return b64::encode(data, len); },
+        [](char* out, const char* in, int len) { return b64::encodeTo(out, in, len); },
+        [](const void* data, size_t len) { return b64::decode(data, len); },
+        [](std::string& text, const std::string& src) { appendJsonStrTo(text, src); },
+        [](MultiCAS& mc, std::string& buf) { mc.stringifyTo(buf); }
+    }
+};
+
+struct Corpus
+{
+    std::string name;
+    std::vector<std::string> items;
+    size_t bytes{ 0 };
+    
+    void add(std::string item)
+    {
+        bytes += item.size();
+        items.push_back(std::move(item));
+    }
+};
+
+Corpus binary(const char* name, size_t count, size_t size, std::minstd_rand& rng)
+{
+    Corpus c;
+    c.name = name;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string item(size, '\0');
+        for (auto& ch : item)
+            ch = static_cast<char>(rng());
+        c.add(std::move(item));
+    }
+    return c;
+}
+
+void appendUtf8(std::string& str, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        str += static_cast<char>(cp);
+    }
+    else if (cp < 0x800)
+    {
+        str += static_cast<char>(0xC0 | (cp >> 6));
+        str += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        str += static_cast<char>(0xE0 | (cp >> 12));
+        str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        str += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+/**
+ * cjk_ratio of the characters are CJK ideographs, the rest ascii words with the occasional escape.
+ */
+Corpus text(const char* name, size_t count, size_t chars, double cjk_ratio, std::minstd_rand& rng)
+{
+    static const char* const WORDS[] = { "the ", "todo ", "list ", "item ", "done, ", "\"quoted\" ", "tab\t", "line\n" };
+    
+    Corpus c;
+    c.name = name;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string item;
+        for (size_t n = 0; n < chars;)
+        {
+            if (rng() % 1000 < cjk_ratio * 1000)
+            {
+                appendUtf8(item, 0x4E00 + rng() % (0x9FFF - 0x4E00));
+                n++;
+            }
+            else
+            {
+                const char* w = WORDS[rng() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+                item += w;
+                n += std::strlen(w);
+            }
+        }
+        c.add(std::move(item));
+    }
+    return c;
+}
+
+struct Bench
+{
+    const Variant* variant;
+    bench::Report report;
+    int64_t min_ns;
+    
+    /**
+     * op processes the whole corpus; only the allocations within the timed part are counted.
+     */
+    void measure(const char* op, const std::string& fields, size_t items, size_t bytes,
+            const std::function<void()>& setup, const std::function<void()>& fn)
+    {
+        uint64_t allocs = 0, alloc_size = 0;
+        bench::Timing t = bench::run([&]() {
+            if (setup)
+                setup();
+            
+            uint64_t count = alloc_count.load(std::memory_order_relaxed);
+            uint64_t size = alloc_bytes.load(std::memory_order_relaxed);
+            int64_t start = bench::nanos();
+            fn();
+            int64_t ns = bench::nanos() - start;
+            allocs += alloc_count.load(std::memory_order_relaxed) - count;
+            alloc_size += alloc_bytes.load(std::memory_order_relaxed) - size;
+            return ns;
+        }, min_ns, min_ns * 10);
+        
+        std::string f("\"variant\":\"");
+        f += variant->name;
+        f += "\",";
+        f += fields;
+        f += ",\"allocs_per_op\":";
+        f += std::to_string(static_cast<double>(allocs) / t.iterations);
+        f += ",\"alloc_bytes_per_op\":";
+        f += std::to_string(static_cast<double>(alloc_size) / t.iterations);
+        report.add(op, f, t, items, bytes);
+    }
+    
+    static std::string corpusFields(const Corpus& c)
+    {
+        std::string f("\"corpus\":\"");
+        f += c.name;
+        f += "\",\"items\":";
+        f += std::to_string(c.items.size());
+        f += ",\"bytes\":";
+        f += std::to_string(c.bytes);
+        return f;
+    }
+    
+    void base64(const Corpus& c)
+    {
+        size_t max = 0;
+        for (auto& item : c.items)
+            max = std::max(max, item.size());
+        
+        std::vector<char> out(max * 4 / 3 + 8);
+        std::vector<std::string> encoded;
+        for (auto& item : c.items)
+            encoded.push_back(variant->encode(item.data(), item.size()));
+        
+        size_t sink = 0;
+        measure("b64.encode", corpusFields(c), c.items.size(), c.bytes, nullptr, [&]() {
+            for (auto& item : c.items)
+                sink += variant->encode(item.data(), item.size()).size();
+        });
+        measure("b64.encodeTo", corpusFields(c), c.items.size(), c.bytes, nullptr, [&]() {
+            for (auto& item : c.items)
+                sink += variant->encodeTo(out.data(), item.data(), static_cast<int>(item.size()));
+        });
+        measure("b64.decode", corpusFields(c), c.items.size(), c.bytes, nullptr, [&]() {
+            for (auto& item : encoded)
+                sink += variant->decode(item.data(), item.size()).size();
+        });
+        bench::consume(sink);
+    }
+    
+    void json(const Corpus& c)
+    {
+        std::string buf;
+        size_t sink = 0;
+        measure("appendJsonStrTo", corpusFields(c), c.items.size(), c.bytes, nullptr, [&]() {
+            for (auto& item : c.items)
+            {
+                buf.clear();
+                variant->appendJsonStrTo(buf, item);
+                sink += buf.size();
+            }
+        });
+        bench::consume(sink);
+    }
+    
+    /**
+     * Edits of field_count fields spread over the value types (stringifyTo consumes the edits).
+     */
+    void multiCAS(int field_count, const Corpus& strings)
+    {
+        MultiCAS mc;
+        std::string buf;
+        size_t sink = 0;
+        auto fill = [&]() {
+            mc.clear();
+            for (int f = 1; f <= field_count; f++)
+            {
+                switch (f % 5)
+                {
+                    case 0:
+                        mc.add(f, strings.items[f % strings.items.size()], strings.items[(f + 1) % strings.items.size()]);
+                        break;
+                    case 1:
+                        mc.add(f, f % 2 == 0);
+                        break;
+                    case 2:
+                        mc.addInt32(f, f, f - 1);
+                        break;
+                    case 3:
+                        mc.add(f, f * 1.5, f * 0.5);
+                        break;
+                    default:
+                        mc.add(f, static_cast<int64_t>(f) << 33, static_cast<int64_t>(f));
+                        break;
+                }
+            }
+        };
+        
+        std::string f("\"fields\":");
+        f += std::to_string(field_count);
+        measure("MultiCAS.stringifyTo", f, field_count, 0, fill, [&]() {
+            buf.clear();
+            variant->stringifyTo(mc, buf);
+            sink += buf.size();
+        });
+        bench::consume(sink);
+    }
+    
+    /**
+     * The success envelopes among the 200 responses of the recording (to uri, if set), decompressed.
+     */
+    static Corpus responses(const rpc::Recording& rec, const char* uri)
+    {
+        zip::Inflater inflater;
+        Corpus c;
+        c.name = "recording";
+        for (size_t i = 0; i < rec.size(); i++)
+        {
+            const rpc::Record& r = rec[i];
+            if (r.status != 200 || (uri != nullptr && (r.uri_len != std::strlen(uri) || 0 != std::memcmp(r.uri, uri, r.uri_len))))
+                continue;
+            
+            std::string body;
+            if (r.encoding_len == 0 || (r.encoding_len == 8 && 0 == std::memcmp(r.encoding, "identity", 8)))
+                body.assign(r.response, r.response_len);
+            else if (!inflater.decompress(body, r.response, r.response_len))
+                continue;
+            
+            if (body.size() > 5 && 0 == body.compare(0, 4, "+[0,"))
+                c.add(std::move(body));
+        }
+        return c;
+    }
+    
+    /**
+     * Checks the Transcoder against the Parser over the corpus, then times both.
+     * Returns false if any transcoded message differs from the Parser's.
+     */
+    bool transcode(const Corpus& c, flatbuffers::Parser& parser, flatbuffers::StructDef* root)
+    {
+        rpc::Transcoder transcoder{ parser };
+        transcoder.verify = true;
+        
+        std::string buf, errmsg;
+        for (auto& item : c.items)
+        {
+            buf = item;
+            transcoder.parseJson(buf, root, errmsg);
+        }
+        
+        size_t mismatches = transcoder.mismatches;
+        std::string f(corpusFields(c));
+        f += ",\"transcoded\":";
+        f += std::to_string(transcoder.transcoded);
+        f += ",\"fallbacks\":";
+        f += std::to_string(transcoder.fallbacks);
+        f += ",\"mismatches\":";
+        f += std::to_string(mismatches);
+        
+        transcoder.verify = false;
+        size_t sink = 0;
+        measure("parse.Parser", corpusFields(c), c.items.size(), c.bytes, nullptr, [&]() {
+            for (auto& item : c.items)
+            {
+                buf = item;
+                sink += rpc::parseJsonTo(buf, root, parser, errmsg) ? parser.builder_.GetSize() : 0;
+            }
+        });
+        measure("parse.Transcoder", f, c.items.size(), c.bytes, nullptr, [&]() {
+            for (auto& item : c.items)
+            {
+                buf = item;
+                sink += transcoder.parseJson(buf, root, errmsg) ? parser.builder_.GetSize() : 0;
+            }
+        });
+        bench::consume(sink);
+        
+        if (mismatches != 0)
+            std::fprintf(stderr, "Transcoder output differs from the Parser for %zu of %zu messages\n", mismatches, c.items.size());
+        
+        return mismatches == 0;
+    }
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bench::Args args{ argc, argv };
+    const char* name = args.get("variant", "baseline");
+    
+    Bench b;
+    b.variant = nullptr;
+    for (auto& v : VARIANTS)
+    {
+        if (0 == std::strcmp(v.name, name))
+            b.variant = &v;
+    }
+    if (b.variant == nullptr)
+    {
+        std::fprintf(stderr, "Unknown variant: %s\n", name);
+        return 1;
+    }
+    
+    b.min_ns = args.getInt("min_ms", 200) * 1000000;
+    b.report.param("variant", name);
+    
+    std::minstd_rand rng(static_cast<unsigned>(args.getInt("seed", 1)));
+    
+    // 9-byte keys (12 chars encoded)
+    b.base64(binary("keys", 1000, 9, rng));
+    b.base64(binary("blob_4k", 64, 4 * 1024, rng));
+    b.base64(binary("blob_64k", 8, 64 * 1024, rng));
+    
+    Corpus ascii = text("ascii", 1000, 64, 0, rng);
+    b.json(ascii);
+    b.json(text("ascii_long", 32, 4096, 0, rng));
+    b.json(text("cjk", 1000, 64, 0.8, rng));
+    b.json(text("cjk_long", 32, 4096, 0.8, rng));
+    
+    for (int fields : { 1, 10, 100, 500 })
+        b.multiCAS(fields, ascii);
+    
+    bool same = true;
+    if (const char* path = args.get("recording"))
+    {
+        rpc::Recording rec;
+        rpc::Schema schema;
+        flatbuffers::Parser parser;
+        const char* root_name = args.get("root", "");
+        flatbuffers::StructDef* root;
+        if (!rec.open(path))
+        {
+            std::fprintf(stderr, "Not a recording: %s\n", path);
+            return 1;
+        }
+        if (!schema.open(args.get("schema", "")) || !schema.loadInto(parser))
+        {
+            std::fprintf(stderr, "Could not load the binary schema (--schema)\n");
+            return 1;
+        }
+        if (nullptr == (root = parser.structs_.Lookup(root_name)))
+        {
+            std::fprintf(stderr, "Unknown root type: %s\n", root_name);
+            return 1;
+        }
+        
+        same = b.transcode(Bench::responses(rec, args.get("uri")), parser, root);
+    }
+    
+    return b.report.write("codec", args.get("out")) && same ? 0 : 1;
+}
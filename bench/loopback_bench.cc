@@ -0,0 +1,215 @@
+// rpc::Base end to end against a local stand-in server: requests/s and response latency percentiles.
+//
+// loopback_bench [--clients=4] [--depth=8] [--seconds=5] [--rows=10] [--row_bytes=64]
+//                [--delay_ms=0] [--drop_every=0] [--error_every=0] [--transcode=0] [--out=results.json]
+//
+// Concurrency is clients (one connection and event loop each) times depth (pipelined requests per connection).
+
+#include <thread>
+
+#include <coreds/rpc.h>
+#include <coreds/transcode.h>
+
+#include "bench.h"
+#include "standin.h"
+
+using namespace coreds;
+
+namespace {
+
+const char* const SCHEMA = R"(
+table Item {
+  key: string;
+  ts: long;
+  title: string;
+}
+table Item_PList {
+  p: [Item];
+}
+)";
+
+const char* const URI = "/bench/Item/list";
+const char* const REQ_BODY = R"({"1":true,"2":10})";
+
+struct Client : rpc::Base
+{
+    const int depth;
+    const bool transcode;
+    std::atomic<bool> running{ true };
+    std::atomic<uint64_t> completed{ 0 };
+    std::atomic<uint64_t> failed{ 0 };
+    bool loaded;
+
+private:
+    brynet::net::HttpSession::PTR session;
+    rpc::Transcoder transcoder{ parser };
+    flatbuffers::StructDef* root;
+    int inflight{ 0 };
+    
+    void fill()
+    {
+        while (session && running && inflight < depth)
+        {
+            // false when dropped (true when queued for replay, answered after the reconnect)
+            if (!post(session, URI, REQ_BODY, true))
+                break;
+            
+            inflight++;
+        }
+    }
+
+public:
+    Client(const rpc::Config config, int depth, bool transcode) :
+        rpc::Base(config), depth(depth), transcode(transcode)
+    {
+        loaded = parser.Parse(SCHEMA);
+        root = loaded ? parser.structs_.Lookup("Item_PList") : nullptr;
+        auto_reconnect = true;
+        reconnect_min_ms = 10;
+    }
+    
+    bool run()
+    {
+        start();
+        return connect();
+    }
+    
+    void onLoop(const brynet::net::EventLoop::PTR&) override
+    {
+        // idle
+    }
+    
+    void onHttpOpen(const brynet::net::HttpSession::PTR& session) override
+    {
+        // the requests in flight when it dropped were replayed already
+        this->session = session;
+        fill();
+    }
+    
+    void onHttpData(const brynet::net::HTTPParser& httpParser, const brynet::net::HttpSession::PTR&) override
+    {
+        inflight--;
+        
+        std::string& body = readBody(httpParser);
+        bool ok = transcode ? transcoder.parseJson(body, root, errmsg) : parseBody(body, "Item_PList");
+        if (ok)
+            completed++;
+        else
+            failed++;
+        
+        fill();
+    }
+    
+    void onHttpClose(const brynet::net::HttpSession::PTR&) override
+    {
+        this->session = nullptr;
+    }
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bench::Args args{ argc, argv };
+    
+    bench::StandinServer::Options opts;
+    opts.rows = static_cast<int>(args.getInt("rows", 10));
+    opts.row_bytes = static_cast<int>(args.getInt("row_bytes", 64));
+    opts.delay_ms = static_cast<int>(args.getInt("delay_ms", 0));
+    opts.drop_every = static_cast<int>(args.getInt("drop_every", 0));
+    opts.error_every = static_cast<int>(args.getInt("error_every", 0));
+    
+    int clients = static_cast<int>(args.getInt("clients", 4));
+    int depth = static_cast<int>(args.getInt("depth", 8));
+    int64_t seconds = args.getInt("seconds", 5);
+    bool transcode = 0 != args.getInt("transcode", 0);
+    
+    bench::StandinServer server(opts);
+    if (!server.start())
+    {
+        std::fprintf(stderr, "Could not start the stand-in server.\n");
+        return 1;
+    }
+    
+    metrics::Registry registry;
+    std::vector<std::unique_ptr<Client>> list;
+    for (int i = 0; i < clients; i++)
+    {
+        list.emplace_back(new Client({ "127.0.0.1", server.port(), false }, depth, transcode));
+        Client& c = *list.back();
+        c.metrics = &registry;
+        if (!c.loaded || !c.run())
+        {
+            std::fprintf(stderr, "Could not start client %d: %s\n", i, c.parser.error_.c_str());
+            return 1;
+        }
+    }
+    
+    int64_t start = bench::nanos();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    int64_t elapsed = bench::nanos() - start;
+    
+    uint64_t completed = 0, failed = 0;
+    for (auto& c : list)
+    {
+        c->running = false;
+        completed += c->completed;
+        failed += c->failed;
+    }
+    
+    // let the pipelines drain before the server goes away
+    std::this_thread::sleep_for(std::chrono::milliseconds(200 + opts.delay_ms * depth));
+    
+    bench::Report report;
+    report.param("clients", std::to_string(clients), false);
+    report.param("depth", std::to_string(depth), false);
+    report.param("rows", std::to_string(opts.rows), false);
+    report.param("response_bytes", std::to_string(server.responseBody().size()), false);
+    report.param("delay_ms", std::to_string(opts.delay_ms), false);
+    report.param("drop_every", std::to_string(opts.drop_every), false);
+    report.param("error_every", std::to_string(opts.error_every), false);
+    report.param("transcode", transcode ? "true" : "false", false);
+    
+    std::string fields("\"completed\":");
+    fields += std::to_string(completed);
+    fields += ",\"failed\":";
+    fields += std::to_string(failed);
+    fields += ",\"drops\":";
+    fields += std::to_string(server.dropCount());
+    fields += ",\"requests_per_sec\":";
+    fields += std::to_string(completed * 1e9 / elapsed);
+    
+    auto snapshot = registry.snapshot();
+    for (auto& e : snapshot.entries)
+    {
+        if (e.uri != URI)
+            continue;
+        
+        for (auto stage : { metrics::Stage::RESPONSE, metrics::Stage::PARSE, metrics::Stage::CALLBACK })
+        {
+            const char* name = metrics::STAGE_NAMES[static_cast<int>(stage)];
+            fields += ",\"";
+            fields += name;
+            fields += "\":{\"mean_ns\":";
+            fields += std::to_string(e.mean(stage));
+            fields += ",\"p50_ns\":";
+            fields += std::to_string(e.percentile(stage, 0.5));
+            fields += ",\"p99_ns\":";
+            fields += std::to_string(e.percentile(stage, 0.99));
+            fields += ",\"p999_ns\":";
+            fields += std::to_string(e.percentile(stage, 0.999));
+            fields += ",\"max_ns\":";
+            fields += std::to_string(e.max[static_cast<int>(stage)]);
+            fields += '}';
+        }
+    }
+    
+    bench::Timing t;
+    t.iterations = completed;
+    t.total_ns = elapsed;
+    report.add("loopback", fields, t);
+    
+    bool ok = report.write("loopback", args.get("out"));
+    server.stop();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+// PojoStore hot paths over synthetic flatbuffer feeds.
+//
+// pstore_bench [--sizes=100,1000,10000,100000,1000000] [--page_size=10] [--dist=dense|sparse]
+//              [--seed=1] [--min_ms=200] [--out=results.json]
+
+#include <algorithm>
+#include <random>
+
+#include <flatbuffers/flatbuffers.h>
+
+#include <coreds/pstore.h>
+
+#include "bench.h"
+
+using namespace coreds;
+
+namespace {
+
+// hand-written accessors, same layout flatc generates for:
+// table Item { key: string; ts: long; title: string; }
+// table Item_PList { p: [Item]; }
+struct Item : flatbuffers::Table
+{
+    enum
+    {
+        VT_KEY = 4,
+        VT_TS = 6,
+        VT_TITLE = 8
+    };
+    
+    const flatbuffers::String* key() const
+    {
+        return GetPointer<const flatbuffers::String*>(VT_KEY);
+    }
+    int64_t ts() const
+    {
+        return GetField<int64_t>(VT_TS, 0);
+    }
+    const flatbuffers::String* title() const
+    {
+        return GetPointer<const flatbuffers::String*>(VT_TITLE);
+    }
+};
+
+typedef flatbuffers::Vector<flatbuffers::Offset<Item>> ItemVector;
+
+struct ItemList : flatbuffers::Table
+{
+    const ItemVector* p() const
+    {
+        return GetPointer<const ItemVector*>(4);
+    }
+};
+
+struct Pojo
+{
+    std::string key;
+    int64_t ts;
+    std::string title;
+    
+    Pojo(const Item* message) :
+        key(message->key()->c_str(), 12),
+        ts(message->ts()),
+        title(message->title()->c_str(), message->title()->size()) {}
+};
+
+typedef PojoStore<Pojo, Item> Store;
+
+/**
+ * Newest first (desc), like a list response.
+ * dense: consecutive timestamps, sparse: random gaps (exercises the carries of incAndWriteKeyTo).
+ */
+std::vector<std::string> generateKeys(size_t count, bool sparse, std::minstd_rand& rng)
+{
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    
+    uint64_t ts = 1500000000000ULL + count * 1000;
+    char raw[9], encoded[13];
+    for (size_t i = 0; i < count; i++)
+    {
+        ts -= sparse ? 1 + rng() % 1000 : 1;
+        for (int b = 0; b < 8; b++)
+            raw[b] = static_cast<char>(ts >> (56 - b * 8));
+        raw[8] = static_cast<char>(i & 0xFF);
+        
+        b64::encodeTo(encoded, raw, 9);
+        keys.emplace_back(encoded, 12);
+    }
+    return keys;
+}
+
+/**
+ * Builds an Item_PList from keys[indices] and returns its vector.
+ */
+const ItemVector* buildFeed(flatbuffers::FlatBufferBuilder& fbb,
+        const std::vector<std::string>& keys, const std::vector<size_t>& indices)
+{
+    fbb.Clear();
+    
+    std::vector<flatbuffers::Offset<Item>> items;
+    items.reserve(indices.size());
+    for (size_t idx : indices)
+    {
+        auto key = fbb.CreateString(keys[idx]);
+        auto title = fbb.CreateString("synthetic title of a typical length");
+        
+        auto start = fbb.StartTable();
+        fbb.AddElement<int64_t>(Item::VT_TS, static_cast<int64_t>(idx), 0);
+        fbb.AddOffset(Item::VT_TITLE, title);
+        fbb.AddOffset(Item::VT_KEY, key);
+        items.emplace_back(fbb.EndTable(start));
+    }
+    
+    auto vec = fbb.CreateVector(items);
+    auto start = fbb.StartTable();
+    fbb.AddOffset(4, vec);
+    fbb.Finish(flatbuffers::Offset<ItemList>(fbb.EndTable(start)));
+    
+    return flatbuffers::GetRoot<ItemList>(fbb.GetBufferPointer())->p();
+}
+
+std::vector<size_t> range(size_t from, size_t to)
+{
+    std::vector<size_t> indices;
+    indices.reserve(to - from);
+    for (size_t i = from; i < to; i++)
+        indices.push_back(i);
+    return indices;
+}
+
+struct Bench
+{
+    bench::Report report;
+    int page_size;
+    int64_t min_ns;
+    std::string prk_buf;
+    int64_t sink{ 0 };
+    
+    void wire(Store& store)
+    {
+        Opts opts;
+        opts.pageSize = page_size;
+        store.init(opts);
+        
+        store.$fnKey = [](const Pojo& pojo) {
+            return pojo.key.c_str();
+        };
+        store.$fnKeyFB = [](const Item* message) {
+            return message->key()->c_str();
+        };
+        store.$fnFetch = [this](ParamRangeKey prk) {
+            // serialize like a real request, but never go loading
+            prk_buf.clear();
+            prk.stringifyTo(prk_buf);
+            return false;
+        };
+        store.$fnUpdate = [](Pojo& pojo, const Item* message) {
+            pojo.ts = message->ts();
+        };
+        store.$fnEvent = [](EventType type, bool on) {};
+        store.$fnPopulate = [this](int idx, Pojo* pojo, int64_t now) {
+            if (pojo)
+                sink += pojo->ts;
+        };
+        store.$fnCall = [](std::function<void()> op) {
+            op();
+        };
+    }
+    
+    bench::Timing run(const std::function<int64_t()>& op)
+    {
+        return bench::run(op, min_ns, min_ns * 10);
+    }
+    
+    static std::string fields(size_t size, const char* extra = nullptr)
+    {
+        std::string str("\"size\":");
+        str += std::to_string(size);
+        if (extra)
+        {
+            str += ',';
+            str += extra;
+        }
+        return str;
+    }
+    
+    void caseSize(const std::vector<std::string>& keys)
+    {
+        size_t n = keys.size();
+        flatbuffers::FlatBufferBuilder fbb(1024 * 1024);
+        const ItemVector* feed = buildFeed(fbb, keys, range(0, n));
+        
+        bench::Timing t = run([&]() {
+            Store store;
+            wire(store);
+            int64_t start = bench::nanos();
+            store.appendAll(feed);
+            return bench::nanos() - start;
+        });
+        report.add("appendAll", fields(n), t, n);
+        
+        t = run([&]() {
+            Store store;
+            wire(store);
+            int64_t start = bench::nanos();
+            store.prependAll(feed, true);
+            return bench::nanos() - start;
+        });
+        report.add("prependAll", fields(n), t, n);
+        
+        // the stores below are filled once (or refilled untimed)
+        Store store;
+        wire(store);
+        store.appendAll(feed);
+        
+        t = run([&]() {
+            int64_t start = bench::nanos();
+            store.populate();
+            return bench::nanos() - start;
+        });
+        report.add("populate", fields(n), t, page_size);
+        
+        int pages = store.getPageCount() + 1;
+        int page = 0;
+        t = run([&]() {
+            page = page + 1 == pages ? 0 : page + 1;
+            int64_t start = bench::nanos();
+            store.pageTo(page);
+            return bench::nanos() - start;
+        });
+        report.add("pageTo", fields(n), t, page_size);
+        
+        // the key of the first visible item, incremented and serialized (the fetch itself is refused)
+        const char* positions[] = { "first", "mid" };
+        for (int pos = 0; pos < 2; pos++)
+        {
+            store.pageTo(pos == 0 ? 0 : (pages - 1) / 2);
+            t = run([&]() {
+                int64_t start = bench::nanos();
+                store.fetchUpdate();
+                return bench::nanos() - start;
+            });
+            std::string extra("\"page\":\"");
+            extra += positions[pos];
+            extra += '"';
+            report.add("fetchUpdate", fields(n, extra.c_str()), t);
+        }
+        
+        // update of a visible page, a ratio of its items removed on the server
+        const double ratios[] = { 0, 0.1, 0.5, 0.9 };
+        flatbuffers::FlatBufferBuilder ufbb;
+        for (int pos = 0; pos < 2; pos++)
+        {
+            int upage = pos == 0 ? 0 : (pages - 1) / 2;
+            size_t from = static_cast<size_t>(upage) * page_size;
+            size_t to = std::min(n, from + page_size);
+            
+            for (double ratio : ratios)
+            {
+                // drop items spread evenly over the page
+                std::vector<size_t> kept;
+                size_t len = to - from;
+                size_t drop = static_cast<size_t>(ratio * len + 0.5);
+                for (size_t j = 0; j < len; j++)
+                {
+                    if (j * drop / len == (j + 1) * drop / len)
+                        kept.push_back(from + j);
+                }
+                if (kept.empty())
+                    continue;
+                
+                const ItemVector* update = buildFeed(ufbb, keys, kept);
+                t = run([&]() {
+                    Store s;
+                    wire(s);
+                    s.appendAll(feed);
+                    s.pageTo(upage);
+                    
+                    int64_t start = bench::nanos();
+                    s.update(update);
+                    return bench::nanos() - start;
+                });
+                
+                std::string extra("\"page\":\"");
+                extra += positions[pos];
+                extra += "\",\"ratio\":";
+                extra += std::to_string(ratio);
+                report.add("update", fields(n, extra.c_str()), t, kept.size());
+            }
+        }
+    }
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bench::Args args{ argc, argv };
+    
+    Bench b;
+    b.page_size = static_cast<int>(args.getInt("page_size", 10));
+    b.min_ns = args.getInt("min_ms", 200) * 1000000;
+    
+    bool sparse = 0 == std::strcmp("sparse", args.get("dist", "dense"));
+    std::minstd_rand rng(static_cast<unsigned>(args.getInt("seed", 1)));
+    
+    b.report.param("page_size", std::to_string(b.page_size), false);
+    b.report.param("dist", sparse ? "sparse" : "dense");
+    
+    for (int64_t size : args.getList("sizes", "100,1000,10000,100000,1000000"))
+    {
+        if (size > 0)
+            b.caseSize(generateKeys(static_cast<size_t>(size), sparse, rng));
+    }
+    
+    bench::consume(b.sink);
+    return b.report.write("pstore", args.get("out")) ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace coreds {
+namespace bench {
+
+/**
+ * Local stand-in for a protostuffdb backend (POSIX sockets, a thread per connection).
+ *
+ * Every POST gets the same list response: +[0,{"1":[{"1":key,"2":ts,"3":title},...]}]
+ * (or the body built by the handler) with configurable delays, error envelopes and dropped connections.
+ */
+struct StandinServer
+{
+    struct Options
+    {
+        int rows{ 10 };
+        // approximate json size of a row
+        int row_bytes{ 64 };
+        // before each response
+        int delay_ms{ 0 };
+        // close the connection instead of answering every n-th request (0 disables)
+        int drop_every{ 0 };
+        // send the first half of that response before closing
+        bool drop_partial{ false };
+        // answer every n-th request with -Simulated error. (0 disables)
+        int error_every{ 0 };
+        // when set, builds the response body of each request instead of the list (on the connection's thread)
+        std::function<std::string(const std::string& uri, const std::string& body)> handler;
+    };
+    
+    const Options opts;
+
+private:
+    int listen_fd{ -1 };
+    int port_{ 0 };
+    std::string response;
+    std::string error_response;
+    std::thread acceptor;
+    std::vector<std::thread> workers;
+    std::vector<int> conns;
+    std::mutex mutex;
+    std::atomic<bool> stopping{ false };
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> drops{ 0 };
+    
+    static std::string httpResponse(const std::string& body)
+    {
+        std::string res("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: ");
+        res += std::to_string(body.size());
+        res += "\r\n\r\n";
+        res += body;
+        return res;
+    }
+    
+    void buildResponses()
+    {
+        std::string body("+[0,{\"1\":[");
+        for (int i = 0; i < opts.rows; i++)
+        {
+            if (i != 0)
+                body += ',';
+            
+            // 12-char keys, like the real ones
+            char key[13];
+            std::snprintf(key, sizeof(key), "AAAAAA%06d", i);
+            
+            body += "{\"1\":\"";
+            body += key;
+            body += "\",\"2\":";
+            body += std::to_string(1500000000000LL + i);
+            body += ",\"3\":\"";
+            body.append(static_cast<size_t>(std::max(1, opts.row_bytes - 40)), 'x');
+            body += "\"}";
+        }
+        body += "]}]";
+        
+        response = httpResponse(body);
+        error_response = httpResponse("-Simulated error.");
+    }
+    
+    /**
+     * Returns the length of the complete request at the start of buf, or 0.
+     */
+    static size_t requestLength(const std::string& buf)
+    {
+        size_t header_end = buf.find("\r\n\r\n");
+        if (header_end == std::string::npos)
+            return 0;
+        
+        size_t content_length = 0;
+        for (size_t pos = 0; pos < header_end;)
+        {
+            size_t eol = buf.find("\r\n", pos);
+            if (eol - pos > 15 && 0 == strncasecmp(buf.data() + pos, "content-length:", 15))
+                content_length = std::strtoul(buf.c_str() + pos + 15, nullptr, 10);
+            pos = eol + 2;
+        }
+        
+        size_t total = header_end + 4 + content_length;
+        return buf.size() >= total ? total : 0;
+    }
+    
+    std::string handle(const std::string& req)
+    {
+        // POST /uri HTTP/1.1
+        size_t start = req.find(' ') + 1,
+                end = req.find(' ', start),
+                body = req.find("\r\n\r\n") + 4;
+        
+        return httpResponse(opts.handler(req.substr(start, end - start), req.substr(body)));
+    }
+    
+    void serve(int fd)
+    {
+        std::string in, out, req;
+        char chunk[16 * 1024];
+        for (ssize_t n; !stopping && 0 < (n = ::recv(fd, chunk, sizeof(chunk), 0));)
+        {
+            in.append(chunk, static_cast<size_t>(n));
+            
+            // answer everything pipelined so far with a single write
+            out.clear();
+            for (size_t len; 0 != (len = requestLength(in));)
+            {
+                if (opts.handler)
+                    req.assign(in, 0, len);
+                
+                in.erase(0, len);
+                uint64_t seq = ++requests;
+                if (opts.drop_every != 0 && seq % opts.drop_every == 0)
+                {
+                    drops++;
+                    if (opts.drop_partial)
+                        out.append(response, 0, response.size() / 2);
+                    if (!out.empty())
+                        ::send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+                    ::shutdown(fd, SHUT_RDWR);
+                    return;
+                }
+                
+                if (opts.delay_ms != 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(opts.delay_ms));
+                
+                if (opts.error_every != 0 && seq % opts.error_every == 0)
+                    out += error_response;
+                else if (opts.handler)
+                    out += handle(req);
+                else
+                    out += response;
+            }
+            
+            if (!out.empty() && static_cast<ssize_t>(out.size()) != ::send(fd, out.data(), out.size(), MSG_NOSIGNAL))
+                break;
+        }
+    }
+    
+    void acceptLoop()
+    {
+        for (int fd; !stopping && -1 != (fd = ::accept(listen_fd, nullptr, nullptr));)
+        {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            conns.push_back(fd);
+            workers.emplace_back(&StandinServer::serve, this, fd);
+        }
+    }
+
+public:
+    StandinServer(Options opts) : opts(opts)
+    {
+        buildResponses();
+    }
+    StandinServer(const StandinServer&) = delete;
+    StandinServer& operator=(const StandinServer&) = delete;
+    
+    ~StandinServer()
+    {
+        stop();
+    }
+    
+    int port()
+    {
+        return port_;
+    }
+    uint64_t requestCount()
+    {
+        return requests;
+    }
+    uint64_t dropCount()
+    {
+        return drops;
+    }
+    const std::string& responseBody()
+    {
+        return response;
+    }
+    
+    /**
+     * Listens on 127.0.0.1 (an ephemeral port when 0).
+     */
+    bool start(int port = 0)
+    {
+        if (-1 == (listen_fd = ::socket(AF_INET, SOCK_STREAM, 0)))
+            return false;
+        
+        int one = 1;
+        ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        
+        socklen_t len = sizeof(addr);
+        if (0 != ::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+                0 != ::listen(listen_fd, 128) ||
+                0 != ::getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len))
+        {
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        
+        port_ = ntohs(addr.sin_port);
+        acceptor = std::thread(&StandinServer::acceptLoop, this);
+        return true;
+    }
+    
+    void stop()
+    {
+        if (listen_fd == -1 || stopping.exchange(true))
+            return;
+        
+        ::shutdown(listen_fd, SHUT_RDWR);
+        ::close(listen_fd);
+        acceptor.join();
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int fd : conns)
+            ::shutdown(fd, SHUT_RDWR);
+        for (auto& t : workers)
+            t.join();
+        for (int fd : conns)
+            ::close(fd);
+    }
+};
+
+} // bench
+} // coreds
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <cstring>
+#include <cstdint>
 
 namespace coreds {
 namespace b64 {
@@ -164,5 +165,20 @@ void decAndWriteKeyTo(std::string& out, const char* key)
     *p++ = B64chars[decoded[2] & 0x3F];
 }
 
+/**
+ * Compares 2 keys (12 chars) by their decoded bytes, since the order of B64chars is not ascii order.
+ */
+int compareKeys(const char* a, const char* b)
+{
+    for (int i = 0; i < 12; i++)
+    {
+        int d = B64index[static_cast<uint8_t>(a[i])] - B64index[static_cast<uint8_t>(b[i])];
+        if (d != 0)
+            return d;
+    }
+    
+    return 0;
+}
+
 } // b64
 } // coreds
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "util.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * Spreads requests across the endpoints of Config::parseList (one Base per endpoint).
+ *
+ * pick() samples two healthy endpoints and returns the one with the lower cost,
+ * the latency average (ewma) scaled by the requests in flight (power of two choices).
+ * An endpoint is ejected after max_failures consecutive failures; once eject_ms elapsed,
+ * check() hands it to $fnProbe (e.g a request to a health uri) and onProbe() re-admits it
+ * or doubles its ejection (up to max_eject_ms).
+ *
+ * Thread-safe: every Base reports from its own event loop.
+ */
+struct Balancer
+{
+    int max_failures{ 3 };
+    int eject_ms{ 2000 };
+    int max_eject_ms{ 60000 };
+    // weight of a new latency sample
+    double decay{ 0.3 };
+    
+    std::function<void(size_t endpoint)> $fnProbe;
+
+private:
+    enum class State
+    {
+        HEALTHY,
+        EJECTED,
+        PROBING
+    };
+    
+    struct Endpoint
+    {
+        State state{ State::HEALTHY };
+        int inflight{ 0 };
+        int failures{ 0 };
+        int backoff_ms{ 0 };
+        int64_t retry_at{ 0 };
+        double ewma_ms{ 0 };
+    };
+    
+    std::vector<Endpoint> endpoints;
+    std::vector<size_t> candidates;
+    std::minstd_rand rng{ static_cast<unsigned>(util::now()) };
+    std::mutex mutex;
+    
+    static double cost(const Endpoint& e)
+    {
+        // unknown latency counts as the cheapest so new endpoints get sampled
+        return (e.ewma_ms + 1) * (e.inflight + 1);
+    }
+    
+    void eject(Endpoint& e)
+    {
+        e.backoff_ms = e.backoff_ms == 0 ? eject_ms : std::min(e.backoff_ms * 2, max_eject_ms);
+        e.retry_at = util::now() + e.backoff_ms;
+        e.state = State::EJECTED;
+    }
+    
+    void fail(Endpoint& e)
+    {
+        if (e.state == State::HEALTHY && ++e.failures >= max_failures)
+            eject(e);
+    }
+
+public:
+    Balancer(size_t count) : endpoints(count) {}
+    Balancer(const Balancer&) = delete;
+    Balancer& operator=(const Balancer&) = delete;
+    
+    size_t size()
+    {
+        return endpoints.size();
+    }
+    
+    bool healthy(size_t i)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return endpoints[i].state == State::HEALTHY;
+    }
+    
+    size_t healthyCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = 0;
+        for (auto& e : endpoints)
+        {
+            if (e.state == State::HEALTHY)
+                count++;
+        }
+        return count;
+    }
+    
+    /**
+     * Returns the endpoint to send the next request to, or -1 if none is healthy.
+     */
+    int pick()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        candidates.clear();
+        for (size_t i = 0; i < endpoints.size(); i++)
+        {
+            if (endpoints[i].state == State::HEALTHY)
+                candidates.push_back(i);
+        }
+        
+        switch (candidates.size())
+        {
+            case 0:
+                return -1;
+            case 1:
+                return static_cast<int>(candidates[0]);
+        }
+        
+        size_t a = rng() % candidates.size();
+        size_t b = rng() % (candidates.size() - 1);
+        if (b >= a)
+            b++;
+        
+        a = candidates[a];
+        b = candidates[b];
+        return static_cast<int>(cost(endpoints[a]) <= cost(endpoints[b]) ? a : b);
+    }
+    
+    void onStart(size_t i)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        endpoints[i].inflight++;
+    }
+    
+    /**
+     * A response arrived (ok is false for server errors).
+     */
+    void onComplete(size_t i, bool ok, int64_t latency_ms)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& e = endpoints[i];
+        if (e.inflight != 0)
+            e.inflight--;
+        
+        e.ewma_ms = e.ewma_ms == 0 ? latency_ms : e.ewma_ms + decay * (latency_ms - e.ewma_ms);
+        
+        if (ok)
+            e.failures = 0;
+        else
+            fail(e);
+    }
+    
+    /**
+     * The connection dropped (or could not be established): the requests in flight will not complete.
+     */
+    void onFailure(size_t i)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& e = endpoints[i];
+        e.inflight = 0;
+        fail(e);
+    }
+    
+    /**
+     * Call periodically (e.g from onLoop). Probes the ejected endpoints that are due.
+     */
+    void check()
+    {
+        std::vector<size_t> due;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int64_t now = util::now();
+            for (size_t i = 0; i < endpoints.size(); i++)
+            {
+                auto& e = endpoints[i];
+                if (e.state == State::EJECTED && now >= e.retry_at)
+                {
+                    e.state = State::PROBING;
+                    due.push_back(i);
+                }
+            }
+        }
+        
+        // outside the lock, the probe may complete synchronously
+        for (size_t i : due)
+        {
+            if ($fnProbe != nullptr)
+                $fnProbe(i);
+            else
+                onProbe(i, true);
+        }
+    }
+    
+    void onProbe(size_t i, bool ok)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& e = endpoints[i];
+        if (e.state != State::PROBING)
+            return;
+        
+        if (!ok)
+        {
+            eject(e);
+            return;
+        }
+        
+        e.state = State::HEALTHY;
+        e.failures = 0;
+        e.backoff_ms = 0;
+        e.inflight = 0;
+        // start over, the old latency says little about a recovered replica
+        e.ewma_ms = 0;
+    }
+};
+
+} // rpc
+} // coreds
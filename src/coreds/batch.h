@@ -0,0 +1,192 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "rpc.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * Combines the calls made within one event-loop burst (or until a size threshold is reached)
+ * into a single POST to a batch endpoint.
+ *
+ * Request body: [{"1":"/uri","2":{...}},...]
+ *
+ * Response body: the usual envelope of each call, in order, each prefixed with its length and a newline.
+ * E.g 14\n+[0,{"1":[]}]8\n-Denied.
+ *
+ * A malformed or missing part only fails its own call.
+ * A batch that could not be sent fails its calls right away.
+ * The responses are parsed with the parser given on construction.
+ */
+struct Batch : brynet::NonCopyable
+{
+    typedef std::function<void(bool ok, flatbuffers::Parser& parser, const std::string& errmsg)> Callback;
+    
+    const std::string uri;
+    size_t max_calls{ 32 };
+    size_t max_bytes{ 64 * 1024 };
+    
+    // returns false if it was not sent (e.g dropped by Base::post)
+    std::function<bool(const std::string& uri, const std::string& body)> $fnPost;
+    // when set, the flush is deferred to the end of the current burst (e.g Base::queue)
+    std::function<void(std::function<void()> op)> $fnCall;
+    
+    Batch(const char* uri, flatbuffers::Parser& parser) : uri(uri), parser(parser) {}
+
+private:
+    struct Entry
+    {
+        const char* root;
+        Callback cb;
+        
+        Entry(const char* root, Callback cb) : root(root), cb(std::move(cb)) {}
+    };
+    
+    flatbuffers::Parser& parser;
+    std::vector<Entry> entries;
+    std::deque<std::vector<Entry>> inflight;
+    std::string buf;
+    std::string part;
+    std::string errmsg;
+    bool scheduled{ false };
+    
+    void flushScheduled()
+    {
+        scheduled = false;
+        flush();
+    }
+    const std::function<void()> $flush{
+        std::bind(&Batch::flushScheduled, this)
+    };
+    
+    void failAll(std::vector<Entry>& list, size_t i)
+    {
+        for (size_t len = list.size(); i < len; i++)
+            list[i].cb(false, parser, errmsg);
+    }
+
+public:
+    bool empty()
+    {
+        return entries.empty();
+    }
+    size_t size()
+    {
+        return entries.size();
+    }
+    size_t inflightCount()
+    {
+        return inflight.size();
+    }
+    /**
+     * The callback receives the same result as rpc::parseJson would for a standalone call.
+     */
+    void add(const std::string& call_uri, const std::string& body, const char* root, Callback cb)
+    {
+        buf += entries.empty() ? R"([{"1":")" : R"(,{"1":")";
+        buf += call_uri;
+        buf += R"(","2":)";
+        buf += body;
+        buf += '}';
+        
+        entries.emplace_back(root, std::move(cb));
+        
+        if (entries.size() >= max_calls || buf.size() >= max_bytes)
+        {
+            flush();
+        }
+        else if (!scheduled && $fnCall != nullptr)
+        {
+            scheduled = true;
+            $fnCall($flush);
+        }
+    }
+    void flush()
+    {
+        if (entries.empty())
+            return;
+        
+        buf += ']';
+        bool sent = $fnPost(uri, buf);
+        buf.clear();
+        
+        if (sent)
+        {
+            inflight.emplace_back(std::move(entries));
+            entries.clear();
+            return;
+        }
+        
+        // no response will arrive (callbacks may add calls)
+        std::vector<Entry> list;
+        list.swap(entries);
+        errmsg.assign("Request failed.");
+        failAll(list, 0);
+    }
+    /**
+     * Dispatches the response of the oldest inflight batch.
+     * Returns false if there was none.
+     */
+    bool onResponse(const std::string& body)
+    {
+        if (inflight.empty())
+            return false;
+        
+        std::vector<Entry> list(std::move(inflight.front()));
+        inflight.pop_front();
+        
+        size_t i = 0, len = list.size(), pos = 0, end = body.size(), n;
+        
+        if (end != 0 && '-' == body[0])
+        {
+            // the batch itself was rejected
+            errmsg.assign(body.data() + 1, end - 1);
+            failAll(list, 0);
+            return true;
+        }
+        
+        for (; i < len; i++)
+        {
+            n = 0;
+            while (pos != end && body[pos] >= '0' && body[pos] <= '9')
+                n = n * 10 + (body[pos++] - '0');
+            
+            if (pos == end || '\n' != body[pos] || n > end - ++pos)
+                break;
+            
+            part.assign(body.data() + pos, n);
+            pos += n;
+            
+            auto& e = list[i];
+            errmsg.clear();
+            e.cb(rpc::parseJson(part, e.root, parser, errmsg), parser, errmsg);
+        }
+        
+        if (i != len)
+        {
+            errmsg.assign(MALFORMED_MESSAGE);
+            failAll(list, i);
+        }
+        
+        return true;
+    }
+    /**
+     * Fails every call that is pending or awaiting a response (e.g on close).
+     */
+    void fail(const char* msg)
+    {
+        errmsg.assign(msg);
+        for (; !inflight.empty(); inflight.pop_front())
+            failAll(inflight.front(), 0);
+        
+        failAll(entries, 0);
+        entries.clear();
+        buf.clear();
+    }
+};
+
+} // rpc
+} // coreds
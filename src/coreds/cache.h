@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * Parsed responses (flatbuffer bytes) keyed by uri + request body, with the validator (ETag) to revalidate them.
+ * Entries are evicted least-recently-used first once the memory budget is exceeded.
+ */
+struct ResponseCache
+{
+    /**
+     * A copy of a flatbuffer, aligned to its largest scalar so it can be read in place.
+     * Shared, so a caller holding it is not affected by eviction.
+     */
+    struct Buffer
+    {
+        typedef std::shared_ptr<const Buffer> PTR;
+        
+        Buffer(const uint8_t* data, size_t len) : words((len + sizeof(uint64_t) - 1) / sizeof(uint64_t)), len(len)
+        {
+            if (len != 0)
+                std::memcpy(words.data(), data, len);
+        }
+        
+        const uint8_t* data() const
+        {
+            return reinterpret_cast<const uint8_t*>(words.data());
+        }
+        size_t size() const
+        {
+            return len;
+        }
+    private:
+        std::vector<uint64_t> words;
+        size_t len;
+    };
+    
+    struct Entry
+    {
+        std::string key;
+        std::string etag;
+        Buffer::PTR data;
+        
+        size_t cost() const
+        {
+            return key.size() + etag.size() + data->size() + sizeof(Entry) + sizeof(Buffer);
+        }
+    };
+
+private:
+    size_t budget;
+    size_t used{ 0 };
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    
+    void evict()
+    {
+        while (used > budget && !lru.empty())
+        {
+            auto& e = lru.back();
+            used -= e.cost();
+            index.erase(e.key);
+            lru.pop_back();
+        }
+    }
+
+public:
+    ResponseCache(size_t budget = 4 * 1024 * 1024) : budget(budget) {}
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+    
+    static void keyTo(std::string& key, const std::string& uri, const std::string& body)
+    {
+        key.assign(uri);
+        key += '\0';
+        key += body;
+    }
+    
+    size_t size()
+    {
+        return lru.size();
+    }
+    size_t memoryUsed()
+    {
+        return used;
+    }
+    void setBudget(size_t value)
+    {
+        budget = value;
+        evict();
+    }
+    
+    /**
+     * Returns nullptr if not cached. The entry becomes the most recently used.
+     */
+    const Entry* get(const std::string& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return nullptr;
+        
+        lru.splice(lru.begin(), lru, it->second);
+        return &lru.front();
+    }
+    
+    /**
+     * Returns the validator to send as If-None-Match, or nullptr if not cached.
+     */
+    const std::string* etag(const std::string& key)
+    {
+        auto it = index.find(key);
+        return it == index.end() ? nullptr : &it->second->etag;
+    }
+    
+    void put(const std::string& key, const std::string& etag, Buffer::PTR data)
+    {
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            used -= it->second->cost();
+            lru.erase(it->second);
+            index.erase(it);
+        }
+        
+        Entry e;
+        e.key = key;
+        e.etag = etag;
+        e.data = std::move(data);
+        
+        if (e.cost() > budget)
+            return;
+        
+        used += e.cost();
+        lru.push_front(std::move(e));
+        index.emplace(key, lru.begin());
+        evict();
+    }
+    
+    void remove(const std::string& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return;
+        
+        used -= it->second->cost();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+    
+    void clear()
+    {
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+};
+
+} // rpc
+} // coreds
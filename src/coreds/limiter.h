@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+#include "util.h"
+
+namespace coreds {
+namespace rpc {
+
+const char* const OVERLOADED_MESSAGE = "Overloaded.";
+
+enum class Priority
+{
+    // page fetches the user is waiting on
+    INTERACTIVE,
+    // prefetch, refresh of idle screens
+    BACKGROUND,
+    COUNT
+};
+
+/**
+ * Adaptive concurrency limit in front of Base::post (AIMD on response latency).
+ *
+ * A response within target_ms grows the limit by 1/limit (about +1 per round trip),
+ * a slower or failed one shrinks it by the backoff factor.
+ * Requests over the limit wait in a bounded queue per priority (interactive first),
+ * and the excess is shed with OVERLOADED_MESSAGE.
+ *
+ * Completions are matched in order (one pipelined connection), and everything runs on the event loop.
+ * Set it as Base::limiter and go through Base::submit, which calls onComplete for every request it posted.
+ */
+struct Limiter
+{
+    // returns false if the request was not sent (e.g dropped by Base::post), failing it itself
+    typedef std::function<bool()> Send;
+    typedef std::function<void(const char* errmsg)> Shed;
+    
+    int min_limit{ 1 };
+    int max_limit{ 64 };
+    int target_ms{ 250 };
+    double backoff{ 0.9 };
+    size_t max_queue[static_cast<int>(Priority::COUNT)]{ 64, 16 };
+
+private:
+    struct Pending
+    {
+        Send send;
+        Shed shed;
+    };
+    
+    double limit_;
+    int inflight_{ 0 };
+    uint64_t dropped_{ 0 };
+    std::deque<Pending> queues[static_cast<int>(Priority::COUNT)];
+    std::deque<int64_t> started;
+    
+    bool dispatch(Send& send)
+    {
+        inflight_++;
+        started.push_back(util::now());
+        if (send())
+            return true;
+        
+        // it will never complete
+        inflight_--;
+        started.pop_back();
+        dropped_++;
+        return false;
+    }
+    void drain()
+    {
+        for (auto& q : queues)
+        {
+            while (!q.empty() && inflight_ < static_cast<int>(limit_))
+            {
+                Pending p(std::move(q.front()));
+                q.pop_front();
+                dispatch(p.send);
+            }
+        }
+    }
+    static void shed(Pending& p)
+    {
+        if (p.shed != nullptr)
+            p.shed(OVERLOADED_MESSAGE);
+    }
+
+public:
+    Limiter(double initial_limit = 8) : limit_(initial_limit) {}
+    
+    int inflight()
+    {
+        return inflight_;
+    }
+    double limit()
+    {
+        return limit_;
+    }
+    size_t queued(Priority p)
+    {
+        return queues[static_cast<int>(p)].size();
+    }
+    /**
+     * Requests dispatched but not sent.
+     */
+    uint64_t dropCount()
+    {
+        return dropped_;
+    }
+    
+    /**
+     * Returns false if the request was shed (shed is called with OVERLOADED_MESSAGE) or sent right away and failed.
+     */
+    bool submit(Priority priority, Send send, Shed shed = nullptr)
+    {
+        int p = static_cast<int>(priority);
+        if (inflight_ < static_cast<int>(limit_) && queues[0].empty() && queues[1].empty())
+        {
+            return dispatch(send);
+        }
+        
+        auto& q = queues[p];
+        if (q.size() < max_queue[p])
+        {
+            q.push_back({ std::move(send), std::move(shed) });
+            return true;
+        }
+        
+        // interactive work displaces the newest background work
+        for (int lower = static_cast<int>(Priority::COUNT); --lower > p;)
+        {
+            auto& lq = queues[lower];
+            if (lq.empty())
+                continue;
+            
+            Pending victim(std::move(lq.back()));
+            lq.pop_back();
+            Limiter::shed(victim);
+            
+            q.push_back({ std::move(send), std::move(shed) });
+            return true;
+        }
+        
+        if (shed != nullptr)
+            shed(OVERLOADED_MESSAGE);
+        
+        return false;
+    }
+    
+    /**
+     * Call when the response of the oldest dispatched request arrives (or it fails).
+     */
+    void onComplete(bool ok)
+    {
+        if (inflight_ == 0)
+            return;
+        
+        int64_t latency = util::now() - started.front();
+        started.pop_front();
+        inflight_--;
+        
+        if (ok && latency <= target_ms)
+            limit_ = std::min(static_cast<double>(max_limit), limit_ + 1.0 / limit_);
+        else
+            limit_ = std::max(static_cast<double>(min_limit), limit_ * backoff);
+        
+        drain();
+    }
+    
+    /**
+     * Sheds everything queued (e.g on close).
+     */
+    void clear()
+    {
+        for (auto& q : queues)
+        {
+            std::deque<Pending> list;
+            list.swap(q);
+            for (auto& p : list)
+                shed(p);
+        }
+    }
+    
+    /**
+     * Forgets the dispatched requests (e.g when the connection drops and they will not complete).
+     */
+    void reset()
+    {
+        inflight_ = 0;
+        started.clear();
+        drain();
+    }
+};
+
+} // rpc
+} // coreds
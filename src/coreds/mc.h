@@ -93,6 +93,96 @@ private:
     
     int flags{ 0 };
 public:
+    /**
+     * Writes values into the local pojo (see apply). Each returns false for a field it does not know.
+     */
+    struct Setter
+    {
+        virtual bool setBool(int, bool) { return false; }
+        virtual bool setBytes(int, const std::string&) { return false; }
+        virtual bool setString(int, const std::string&) { return false; }
+        virtual bool setDouble(int, double) { return false; }
+        virtual bool setInt32(int, int) { return false; }
+        virtual bool setFixed32(int, int32_t) { return false; }
+        virtual bool setFixed64(int, int64_t) { return false; }
+    };
+    
+    /**
+     * The old values of the applied fields (copies), to undo an edit the server rejected.
+     */
+    struct Rollback
+    {
+    private:
+        friend struct MultiCAS;
+        
+        std::forward_list<std::tuple<int,bool>> list_bool;
+        std::forward_list<std::tuple<int,std::string>> list_bytes;
+        std::forward_list<std::tuple<int,std::string>> list_string;
+        std::forward_list<std::tuple<int,double>> list_double;
+        std::forward_list<std::tuple<int,int>> list_int32;
+        std::forward_list<std::tuple<int,int32_t>> list_fixed32;
+        std::forward_list<std::tuple<int,int64_t>> list_fixed64;
+        bool empty_{ true };
+    public:
+        bool empty()
+        {
+            return empty_;
+        }
+        void clear()
+        {
+            if (!empty_)
+            {
+                empty_ = true;
+                list_bool.clear();
+                list_bytes.clear();
+                list_string.clear();
+                list_double.clear();
+                list_int32.clear();
+                list_fixed32.clear();
+                list_fixed64.clear();
+            }
+        }
+        /**
+         * Restores the old values (latest edit first) and clears. Returns false if a setter rejected one.
+         */
+        bool undo(Setter& setter)
+        {
+            bool ok = true;
+            for (auto& f : list_bool)
+                ok = setter.setBool(std::get<0>(f), std::get<1>(f)) && ok;
+            for (auto& f : list_bytes)
+                ok = setter.setBytes(std::get<0>(f), std::get<1>(f)) && ok;
+            for (auto& f : list_string)
+                ok = setter.setString(std::get<0>(f), std::get<1>(f)) && ok;
+            for (auto& f : list_double)
+                ok = setter.setDouble(std::get<0>(f), std::get<1>(f)) && ok;
+            for (auto& f : list_int32)
+                ok = setter.setInt32(std::get<0>(f), std::get<1>(f)) && ok;
+            for (auto& f : list_fixed32)
+                ok = setter.setFixed32(std::get<0>(f), std::get<1>(f)) && ok;
+            for (auto& f : list_fixed64)
+                ok = setter.setFixed64(std::get<0>(f), std::get<1>(f)) && ok;
+            
+            clear();
+            return ok;
+        }
+    };
+    
+    /**
+     * Reads the edits without consuming them (e.g to merge them, see rpc::WriteQueue).
+     * The bool edits carry no old value (it is the negation of the new one).
+     */
+    struct Visitor
+    {
+        virtual void visitBool(int, bool) {}
+        virtual void visitBytes(int, const std::string&, const std::string&) {}
+        virtual void visitString(int, const std::string&, const std::string&) {}
+        virtual void visitDouble(int, double, double) {}
+        virtual void visitInt32(int, int, int) {}
+        virtual void visitFixed32(int, int32_t, int32_t) {}
+        virtual void visitFixed64(int, int64_t, int64_t) {}
+    };
+    
     bool empty()
     {
         return flags == 0;
@@ -137,6 +227,7 @@ public:
             list_bool.clear();
             list_bytes.clear();
             list_string.clear();
+            list_double.clear();
             //list_uint32.clear();
             list_int32.clear();
             list_fixed32.clear();
@@ -234,7 +325,121 @@ public:
     {
         return addFixed64(f, static_cast<int64_t>(newVal), oldVal);
     }
+    /**
+     * Visits the edits per type, the latest first.
+     */
+    void visit(Visitor& v)
+    {
+        for (auto& f : list_bool)
+            v.visitBool(std::get<0>(f), std::get<1>(f));
+        for (auto& f : list_bytes)
+            v.visitBytes(std::get<0>(f), *std::get<1>(f), *std::get<2>(f));
+        for (auto& f : list_string)
+            v.visitString(std::get<0>(f), *std::get<1>(f), *std::get<2>(f));
+        for (auto& f : list_double)
+            v.visitDouble(std::get<0>(f), std::get<1>(f), std::get<2>(f));
+        for (auto& f : list_int32)
+            v.visitInt32(std::get<0>(f), std::get<1>(f), std::get<2>(f));
+        for (auto& f : list_fixed32)
+            v.visitFixed32(std::get<0>(f), std::get<1>(f), std::get<2>(f));
+        for (auto& f : list_fixed64)
+            v.visitFixed64(std::get<0>(f), std::get<1>(f), std::get<2>(f));
+    }
+    /**
+     * Optimistic edit: writes the new values into the local pojo before the request is sent,
+     * keeping the old ones in rollback (undo it if the server rejects the compare-and-set).
+     *
+     * Call before stringifyTo (which consumes the edits). The old string/bytes values are copied first
+     * and the edits re-pointed at the copies, since they usually point into the pojo being written,
+     * so the rollback must outlive stringifyTo.
+     * Returns false if the setter rejected a field (that field is left untouched).
+     */
+    bool apply(Setter& setter, Rollback& rollback)
+    {
+        // oldest edit first (the lists are latest first), so the latest value of a field is the one left set,
+        // and the rollback ends up latest first, undoing back to the original value
+        reverse();
+        
+        bool ok = true;
+        for (auto& f : list_bool)
+        {
+            if (!setter.setBool(std::get<0>(f), std::get<1>(f)))
+                ok = false;
+            else
+                rollback.list_bool.emplace_front(std::get<0>(f), !std::get<1>(f));
+        }
+        for (auto& f : list_bytes)
+        {
+            const std::string* old = std::get<2>(f);
+            rollback.list_bytes.emplace_front(std::get<0>(f), *old);
+            std::get<2>(f) = &std::get<1>(rollback.list_bytes.front());
+            if (!setter.setBytes(std::get<0>(f), *std::get<1>(f)))
+            {
+                ok = false;
+                std::get<2>(f) = old;
+                rollback.list_bytes.pop_front();
+            }
+        }
+        for (auto& f : list_string)
+        {
+            const std::string* old = std::get<2>(f);
+            rollback.list_string.emplace_front(std::get<0>(f), *old);
+            std::get<2>(f) = &std::get<1>(rollback.list_string.front());
+            if (!setter.setString(std::get<0>(f), *std::get<1>(f)))
+            {
+                ok = false;
+                std::get<2>(f) = old;
+                rollback.list_string.pop_front();
+            }
+        }
+        for (auto& f : list_double)
+        {
+            if (!setter.setDouble(std::get<0>(f), std::get<1>(f)))
+                ok = false;
+            else
+                rollback.list_double.emplace_front(std::get<0>(f), std::get<2>(f));
+        }
+        for (auto& f : list_int32)
+        {
+            if (!setter.setInt32(std::get<0>(f), std::get<1>(f)))
+                ok = false;
+            else
+                rollback.list_int32.emplace_front(std::get<0>(f), std::get<2>(f));
+        }
+        for (auto& f : list_fixed32)
+        {
+            if (!setter.setFixed32(std::get<0>(f), std::get<1>(f)))
+                ok = false;
+            else
+                rollback.list_fixed32.emplace_front(std::get<0>(f), std::get<2>(f));
+        }
+        for (auto& f : list_fixed64)
+        {
+            if (!setter.setFixed64(std::get<0>(f), std::get<1>(f)))
+                ok = false;
+            else
+                rollback.list_fixed64.emplace_front(std::get<0>(f), std::get<2>(f));
+        }
+        
+        reverse();
+        
+        rollback.empty_ = rollback.list_bool.empty() && rollback.list_bytes.empty() &&
+                rollback.list_string.empty() && rollback.list_double.empty() &&
+                rollback.list_int32.empty() && rollback.list_fixed32.empty() &&
+                rollback.list_fixed64.empty();
+        return ok;
+    }
 private:
+    void reverse()
+    {
+        list_bool.reverse();
+        list_bytes.reverse();
+        list_string.reverse();
+        list_double.reverse();
+        list_int32.reverse();
+        list_fixed32.reverse();
+        list_fixed64.reverse();
+    }
     void bool_to(std::string& buf)
     {
         buf += R"("1":[)";
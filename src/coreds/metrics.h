@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace coreds {
+namespace metrics {
+
+enum class Stage
+{
+    CONNECT,
+    SEND,
+    // from send until the full response is received
+    RESPONSE,
+    PARSE,
+    CALLBACK,
+    COUNT
+};
+
+enum class Counter
+{
+    REQUESTS,
+    BYTES_OUT,
+    BYTES_IN,
+    RECONNECTS,
+    MALFORMED,
+    COUNT
+};
+
+static const char* const STAGE_NAMES[] = {
+    "connect", "send", "response", "parse", "callback"
+};
+
+static const char* const COUNTER_NAMES[] = {
+    "requests", "bytes_out", "bytes_in", "reconnects", "malformed"
+};
+
+inline int64_t nanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Log-linear buckets (HDR-style): values below 16 are exact, above that each power of 2 is split
+ * into 16 sub-buckets, so the relative error is at most 1/16.
+ */
+struct Buckets
+{
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+    
+    static int indexOf(uint64_t v)
+    {
+        if (v < SUB_COUNT)
+            return static_cast<int>(v);
+
+#if defined(__GNUC__) || defined(__clang__)
+        int msb = 63 - __builtin_clzll(v);
+#else
+        int msb = 63;
+        while (!(v & (1ULL << msb))) msb--;
+#endif
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + static_cast<int>((v >> shift) & (SUB_COUNT - 1));
+    }
+    // lowest value of the bucket
+    static uint64_t valueOf(int idx)
+    {
+        if (idx < SUB_COUNT)
+            return idx;
+        
+        int shift = idx / SUB_COUNT - 1;
+        return static_cast<uint64_t>(SUB_COUNT + idx % SUB_COUNT) << shift;
+    }
+};
+
+/**
+ * Written by a single thread (relaxed load + store, no locked instructions), read by snapshots.
+ */
+struct Stats
+{
+    std::atomic<uint64_t> counters[static_cast<int>(Counter::COUNT)];
+    std::atomic<uint64_t> hist[static_cast<int>(Stage::COUNT)][Buckets::COUNT];
+    std::atomic<uint64_t> sum[static_cast<int>(Stage::COUNT)];
+    std::atomic<uint64_t> max[static_cast<int>(Stage::COUNT)];
+    
+    Stats()
+    {
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        for (auto& h : hist) for (auto& c : h) c.store(0, std::memory_order_relaxed);
+        for (auto& c : sum) c.store(0, std::memory_order_relaxed);
+        for (auto& c : max) c.store(0, std::memory_order_relaxed);
+    }
+    
+    static void add(std::atomic<uint64_t>& a, uint64_t v)
+    {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    
+    void inc(Counter c, uint64_t v = 1)
+    {
+        add(counters[static_cast<int>(c)], v);
+    }
+    void record(Stage s, int64_t ns)
+    {
+        int i = static_cast<int>(s);
+        uint64_t v = ns < 0 ? 0 : static_cast<uint64_t>(ns);
+        
+        add(hist[i][Buckets::indexOf(v)], 1);
+        add(sum[i], v);
+        if (v > max[i].load(std::memory_order_relaxed))
+            max[i].store(v, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Merged view of a uri's stats across threads.
+ */
+struct Entry
+{
+    std::string uri;
+    uint64_t counters[static_cast<int>(Counter::COUNT)]{};
+    std::vector<uint64_t> hist[static_cast<int>(Stage::COUNT)];
+    uint64_t count[static_cast<int>(Stage::COUNT)]{};
+    uint64_t sum[static_cast<int>(Stage::COUNT)]{};
+    uint64_t max[static_cast<int>(Stage::COUNT)]{};
+    
+    Entry(const std::string& uri) : uri(uri)
+    {
+        for (auto& h : hist)
+            h.assign(Buckets::COUNT, 0);
+    }
+    
+    uint64_t counter(Counter c) const
+    {
+        return counters[static_cast<int>(c)];
+    }
+    uint64_t mean(Stage s) const
+    {
+        int i = static_cast<int>(s);
+        return count[i] == 0 ? 0 : sum[i] / count[i];
+    }
+    /**
+     * Returns the (bucket-precision) value at the quantile q (0-1), in nanoseconds.
+     */
+    uint64_t percentile(Stage s, double q) const
+    {
+        int i = static_cast<int>(s);
+        if (count[i] == 0)
+            return 0;
+        
+        uint64_t target = static_cast<uint64_t>(q * count[i] + 0.5), seen = 0;
+        if (target == 0)
+            target = 1;
+        
+        for (int b = 0; b < Buckets::COUNT; b++)
+        {
+            if ((seen += hist[i][b]) >= target)
+                return std::min(Buckets::valueOf(b), max[i]);
+        }
+        
+        return max[i];
+    }
+};
+
+struct Snapshot
+{
+    std::vector<Entry> entries;
+    
+    void appendTextTo(std::string& buf) const
+    {
+        for (auto& e : entries)
+        {
+            buf += e.uri;
+            buf += '\n';
+            
+            for (int c = 0; c < static_cast<int>(Counter::COUNT); c++)
+            {
+                buf += "  ";
+                buf += COUNTER_NAMES[c];
+                buf += ": ";
+                buf += std::to_string(e.counters[c]);
+                buf += '\n';
+            }
+            
+            for (int s = 0; s < static_cast<int>(Stage::COUNT); s++)
+            {
+                auto stage = static_cast<Stage>(s);
+                if (e.count[s] == 0)
+                    continue;
+                
+                buf += "  ";
+                buf += STAGE_NAMES[s];
+                buf += " (us): n=";
+                buf += std::to_string(e.count[s]);
+                buf += " mean=";
+                buf += std::to_string(e.mean(stage) / 1000);
+                buf += " p50=";
+                buf += std::to_string(e.percentile(stage, 0.5) / 1000);
+                buf += " p99=";
+                buf += std::to_string(e.percentile(stage, 0.99) / 1000);
+                buf += " p999=";
+                buf += std::to_string(e.percentile(stage, 0.999) / 1000);
+                buf += " max=";
+                buf += std::to_string(e.max[s] / 1000);
+                buf += '\n';
+            }
+        }
+    }
+    /**
+     * Values in nanoseconds.
+     */
+    void appendJsonTo(std::string& buf) const
+    {
+        buf += '[';
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            auto& e = entries[i];
+            if (i != 0)
+                buf += ',';
+            
+            // uris are plain paths, no escaping needed
+            buf += R"({"uri":")";
+            buf += e.uri;
+            buf += '"';
+            
+            for (int c = 0; c < static_cast<int>(Counter::COUNT); c++)
+            {
+                buf += R"(,")";
+                buf += COUNTER_NAMES[c];
+                buf += R"(":)";
+                buf += std::to_string(e.counters[c]);
+            }
+            
+            for (int s = 0; s < static_cast<int>(Stage::COUNT); s++)
+            {
+                auto stage = static_cast<Stage>(s);
+                
+                buf += R"(,")";
+                buf += STAGE_NAMES[s];
+                buf += R"(":{"n":)";
+                buf += std::to_string(e.count[s]);
+                buf += R"(,"mean":)";
+                buf += std::to_string(e.mean(stage));
+                buf += R"(,"p50":)";
+                buf += std::to_string(e.percentile(stage, 0.5));
+                buf += R"(,"p99":)";
+                buf += std::to_string(e.percentile(stage, 0.99));
+                buf += R"(,"p999":)";
+                buf += std::to_string(e.percentile(stage, 0.999));
+                buf += R"(,"max":)";
+                buf += std::to_string(e.max[s]);
+                buf += '}';
+            }
+            
+            buf += '}';
+        }
+        buf += ']';
+    }
+};
+
+/**
+ * Per-uri stats, sharded per thread.
+ *
+ * Resolve a uri to a key once (takes a lock), then record against the key (lock-free).
+ */
+struct Registry
+{
+    static const int MAX_KEYS = 256;
+
+private:
+    struct Shard
+    {
+        std::atomic<Stats*> stats[MAX_KEYS];
+        
+        Shard()
+        {
+            for (auto& s : stats) s.store(nullptr, std::memory_order_relaxed);
+        }
+        ~Shard()
+        {
+            for (auto& s : stats) delete s.load(std::memory_order_relaxed);
+        }
+    };
+    
+    static std::atomic<uint64_t>& counter()
+    {
+        static std::atomic<uint64_t> value{ 0 };
+        return value;
+    }
+    
+    const uint64_t id{ ++counter() };
+    std::vector<std::string> uris;
+    std::unordered_map<std::string, int> keys;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::mutex mutex;
+    
+    Shard* shard()
+    {
+        static thread_local uint64_t last_id{ 0 };
+        static thread_local Shard* last{ nullptr };
+        // ids are never reused, so entries of a destroyed registry are simply never looked up again
+        static thread_local std::unordered_map<uint64_t, Shard*> cache;
+        
+        if (last_id == id)
+            return last;
+        
+        auto it = cache.find(id);
+        if (it != cache.end())
+        {
+            last = it->second;
+        }
+        else
+        {
+            last = new Shard();
+            cache.emplace(id, last);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            shards.emplace_back(last);
+        }
+        
+        last_id = id;
+        return last;
+    }
+
+public:
+    Registry() {}
+    Registry(const Registry&) = delete;
+    Registry& operator=(const Registry&) = delete;
+    
+    /**
+     * Returns -1 if MAX_KEYS is reached.
+     */
+    int key(const std::string& uri)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = keys.find(uri);
+        if (it != keys.end())
+            return it->second;
+        
+        if (uris.size() == MAX_KEYS)
+            return -1;
+        
+        int k = uris.size();
+        uris.push_back(uri);
+        keys.emplace(uri, k);
+        return k;
+    }
+    
+    /**
+     * Returns the calling thread's stats for the key (nullptr if the key is invalid).
+     */
+    Stats* local(int key)
+    {
+        if (key < 0 || key >= MAX_KEYS)
+            return nullptr;
+        
+        auto& slot = shard()->stats[key];
+        Stats* s = slot.load(std::memory_order_relaxed);
+        if (s == nullptr)
+        {
+            s = new Stats();
+            slot.store(s, std::memory_order_release);
+        }
+        return s;
+    }
+    
+    void inc(int key, Counter c, uint64_t v = 1)
+    {
+        if (Stats* s = local(key))
+            s->inc(c, v);
+    }
+    void record(int key, Stage stage, int64_t ns)
+    {
+        if (Stats* s = local(key))
+            s->record(stage, ns);
+    }
+    
+    Snapshot snapshot()
+    {
+        Snapshot snap;
+        std::lock_guard<std::mutex> lock(mutex);
+        
+        snap.entries.reserve(uris.size());
+        for (size_t k = 0; k < uris.size(); k++)
+        {
+            snap.entries.emplace_back(uris[k]);
+            auto& e = snap.entries.back();
+            
+            for (auto& shard : shards)
+            {
+                Stats* s = shard->stats[k].load(std::memory_order_acquire);
+                if (s == nullptr)
+                    continue;
+                
+                for (int c = 0; c < static_cast<int>(Counter::COUNT); c++)
+                    e.counters[c] += s->counters[c].load(std::memory_order_relaxed);
+                
+                for (int i = 0; i < static_cast<int>(Stage::COUNT); i++)
+                {
+                    for (int b = 0; b < Buckets::COUNT; b++)
+                    {
+                        uint64_t n = s->hist[i][b].load(std::memory_order_relaxed);
+                        e.hist[i][b] += n;
+                        e.count[i] += n;
+                    }
+                    e.sum[i] += s->sum[i].load(std::memory_order_relaxed);
+                    e.max[i] = std::max(e.max[i], s->max[i].load(std::memory_order_relaxed));
+                }
+            }
+        }
+        
+        return snap;
+    }
+};
+
+} // metrics
+} // coreds
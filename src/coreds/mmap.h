@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+namespace coreds {
+namespace util {
+
+/**
+ * A read-only file mapped into memory (read into a buffer where mmap is unavailable).
+ */
+struct MappedFile
+{
+private:
+    const uint8_t* data_{ nullptr };
+    size_t size_{ 0 };
+    bool mapped{ false };
+    // fallback when mmap is not available
+    std::string buf;
+
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile()
+    {
+        close();
+    }
+    
+    const uint8_t* data() const
+    {
+        return data_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    
+    /**
+     * Returns false if the file could not be read or is empty.
+     */
+    bool open(const char* path)
+    {
+        close();
+#if !defined(_WIN32)
+        int fd = ::open(path, O_RDONLY);
+        if (fd == -1)
+            return false;
+        
+        struct stat st;
+        void* addr = MAP_FAILED;
+        if (0 == ::fstat(fd, &st) && st.st_size > 0)
+            addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+        
+        data_ = static_cast<const uint8_t*>(addr);
+        size_ = static_cast<size_t>(st.st_size);
+        mapped = true;
+        return true;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        
+        buf.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (buf.empty())
+            return false;
+        
+        data_ = reinterpret_cast<const uint8_t*>(buf.data());
+        size_ = buf.size();
+        return true;
+#endif
+    }
+    
+    void close()
+    {
+#if !defined(_WIN32)
+        if (mapped)
+            ::munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+        mapped = false;
+        data_ = nullptr;
+        size_ = 0;
+        buf.clear();
+    }
+};
+
+} // util
+} // coreds
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace coreds {
+namespace util {
+
+/**
+ * Intrusive task node: embed it in your own object (no allocation per queued task).
+ * run is called once on the consumer thread and owns the node from then on.
+ * drop (optional) is called instead if the queue is discarded with the task still in it.
+ */
+struct Task
+{
+    std::atomic<Task*> next{ nullptr };
+    void (*run)(Task* self){ nullptr };
+    void (*drop)(Task* self){ nullptr };
+};
+
+/**
+ * Task wrapping a std::function. The nodes are recycled through a pool per producer thread,
+ * so only a cold pool allocates one (the std::function may still allocate for large captures).
+ */
+struct FnTask : Task
+{
+    std::function<void()> fn;
+
+private:
+    // the nodes of one producer thread: reused by it, handed back by the consumers
+    struct Pool
+    {
+        // owner thread only
+        FnTask* free{ nullptr };
+        // pushed by the consumers, taken all at once by the owner (so no ABA)
+        std::atomic<FnTask*> returned{ nullptr };
+        // the owner thread, plus every node out of the pool
+        std::atomic<size_t> refs{ 1 };
+        
+        ~Pool()
+        {
+            deleteAll(free);
+            deleteAll(returned.load(std::memory_order_acquire));
+        }
+        
+        static void deleteAll(FnTask* task)
+        {
+            for (FnTask* next; task != nullptr; task = next)
+            {
+                next = task->next_free;
+                delete task;
+            }
+        }
+        
+        void unref()
+        {
+            if (1 == refs.fetch_sub(1, std::memory_order_acq_rel))
+                delete this;
+        }
+    };
+    
+    // the pool outlives its thread until every node is back
+    struct Owner
+    {
+        Pool* pool{ new Pool() };
+        
+        ~Owner()
+        {
+            pool->unref();
+        }
+    };
+    
+    Pool* pool{ nullptr };
+    FnTask* next_free{ nullptr };
+    
+    FnTask()
+    {
+        run = &FnTask::invoke;
+        drop = &FnTask::release;
+    }
+    
+    static void invoke(Task* self)
+    {
+        FnTask* task = static_cast<FnTask*>(self);
+        task->fn();
+        release(task);
+    }
+    
+    static void release(Task* self)
+    {
+        FnTask* task = static_cast<FnTask*>(self);
+        Pool* p = task->pool;
+        task->fn = nullptr;
+        
+        task->next_free = p->returned.load(std::memory_order_relaxed);
+        while (!p->returned.compare_exchange_weak(task->next_free, task, std::memory_order_release, std::memory_order_relaxed))
+        {
+            // retry
+        }
+        
+        p->unref();
+    }
+
+public:
+    /**
+     * Returns a node from the calling thread's pool. It goes back to the pool once run (or dropped).
+     */
+    static FnTask* create(std::function<void()> fn)
+    {
+        static thread_local Owner owner;
+        Pool* p = owner.pool;
+        
+        if (p->free == nullptr)
+            p->free = p->returned.exchange(nullptr, std::memory_order_acquire);
+        
+        FnTask* task = p->free;
+        if (task != nullptr)
+        {
+            p->free = task->next_free;
+        }
+        else
+        {
+            task = new FnTask();
+            task->pool = p;
+        }
+        
+        p->refs.fetch_add(1, std::memory_order_relaxed);
+        task->fn = std::move(fn);
+        return task;
+    }
+};
+
+/**
+ * Multi-producer/single-consumer lock-free queue (Vyukov's intrusive mpsc).
+ *
+ * push() returns true only for the first push after the consumer started draining,
+ * so producers wake the consumer once per burst rather than once per task.
+ */
+struct TaskQueue
+{
+private:
+    std::atomic<Task*> head;
+    Task* tail;
+    Task stub;
+    std::atomic<bool> scheduled{ false };
+    
+    void enqueue(Task* task)
+    {
+        task->next.store(nullptr, std::memory_order_relaxed);
+        Task* prev = head.exchange(task, std::memory_order_acq_rel);
+        prev->next.store(task, std::memory_order_release);
+    }
+    
+    Task* pop()
+    {
+        Task* t = tail;
+        Task* next = t->next.load(std::memory_order_acquire);
+        if (t == &stub)
+        {
+            if (next == nullptr)
+                return nullptr;
+            
+            tail = next;
+            t = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        
+        if (next != nullptr)
+        {
+            tail = next;
+            return t;
+        }
+        
+        if (t != head.load(std::memory_order_acquire))
+        {
+            // a producer is mid-push, it will wake the consumer again
+            return nullptr;
+        }
+        
+        enqueue(&stub);
+        next = t->next.load(std::memory_order_acquire);
+        if (next != nullptr)
+        {
+            tail = next;
+            return t;
+        }
+        
+        return nullptr;
+    }
+
+public:
+    TaskQueue() : head(&stub), tail(&stub) {}
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+    
+    /**
+     * Thread-safe. Returns true if the caller should wake the consumer.
+     */
+    bool push(Task* task)
+    {
+        enqueue(task);
+        return !scheduled.exchange(true, std::memory_order_acq_rel);
+    }
+    
+    /**
+     * Consumer only. Runs everything queued and returns the number of tasks run.
+     */
+    size_t drain()
+    {
+        // pushes from here on wake the consumer again
+        scheduled.store(false, std::memory_order_seq_cst);
+        
+        size_t count = 0;
+        for (Task* task; nullptr != (task = pop()); count++)
+            task->run(task);
+        
+        return count;
+    }
+    
+    /**
+     * Consumer only, once it stopped draining (e.g its loop is gone).
+     * Drops everything queued without running it and returns the number of tasks dropped.
+     */
+    size_t discard()
+    {
+        size_t count = 0;
+        for (Task* task; nullptr != (task = pop()); count++)
+        {
+            if (task->drop)
+                task->drop(task);
+        }
+        
+        return count;
+    }
+};
+
+} // util
+} // coreds
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "rpc.h"
+#include "transcode.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * One parser per thread, each loaded once from the same schema.
+ * The schema text is parsed by the first thread only, the others load its binary form (no re-parsing).
+ * The parser (and its builder buffer) is reused for every response parsed on that thread.
+ */
+struct ParserPool : brynet::NonCopyable
+{
+    struct Local
+    {
+        flatbuffers::Parser parser;
+        bool loaded{ false };
+        // opt-in: numeric-key json straight to flatbuffers, falling back to the parser.
+        // Check it against a corpus of recorded responses first (codec_bench --recording)
+        bool transcode{ false };
+        Transcoder transcoder{ parser };
+        
+        /**
+         * Returns the root type, resolved like SetRootType (also in the current namespace), or nullptr if unknown.
+         */
+        flatbuffers::StructDef* root(const char* name)
+        {
+            return parser.SetRootType(name) ? parser.root_struct_def_ : nullptr;
+        }
+        
+        /**
+         * Same as rpc::parseJson: fails with MALFORMED_MESSAGE if name is not in the schema.
+         */
+        const bool parseJson(std::string& body, const char* name, std::string& errmsg)
+        {
+            if (!transcode)
+                return rpc::parseJson(body, name, parser, errmsg);
+            
+            flatbuffers::StructDef* def = nullptr;
+            if (name && nullptr == (def = root(name)))
+            {
+                if (checkBody(body, errmsg))
+                    errmsg.assign(MALFORMED_MESSAGE);
+                return false;
+            }
+            
+            return transcoder.parseJson(body, def, errmsg);
+        }
+    };
+    
+    const std::string schema;
+    // preferred over the schema text when set
+    const Schema* const binary{ nullptr };
+
+private:
+    static std::atomic<uint64_t>& counter()
+    {
+        static std::atomic<uint64_t> value{ 0 };
+        return value;
+    }
+    
+    const uint64_t id{ ++counter() };
+    std::vector<const char*> include_paths;
+    std::vector<std::string> include_buf;
+    std::vector<std::unique_ptr<Local>> locals;
+    // the schema text, parsed once and serialized (reflection) for the other threads
+    std::vector<uint8_t> cloned;
+    std::mutex mutex;
+    
+    Local* create()
+    {
+        Local* local = new Local();
+        auto& parser = local->parser;
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (binary)
+        {
+            local->loaded = binary->loadInto(parser);
+        }
+        else if (!cloned.empty())
+        {
+            local->loaded = parser.Deserialize(cloned.data(), cloned.size());
+        }
+        else if ((local->loaded = parser.Parse(schema.c_str(), include_paths.empty() ? nullptr : include_paths.data())))
+        {
+            parser.Serialize();
+            const uint8_t* buf = parser.builder_.GetBufferPointer();
+            cloned.assign(buf, buf + parser.builder_.GetSize());
+            parser.builder_.Clear();
+        }
+        
+        locals.emplace_back(local);
+        return local;
+    }
+
+public:
+    ParserPool(std::string schema, const std::vector<std::string>& includes = {}) :
+        schema(std::move(schema)), include_buf(includes)
+    {
+        for (auto& p : include_buf)
+            include_paths.push_back(p.c_str());
+        
+        if (!include_paths.empty())
+            include_paths.push_back(nullptr);
+    }
+    
+    /**
+     * Every thread's parser is loaded from the binary schema, which must outlive the pool.
+     */
+    ParserPool(const Schema& binary) : binary(&binary) {}
+    
+    /**
+     * Returns the calling thread's parser, creating it on first use.
+     * Check Local::loaded for schema errors.
+     */
+    Local& local()
+    {
+        // ids are never reused, so entries of a destroyed pool are simply never looked up again
+        static thread_local std::unordered_map<uint64_t, Local*> cache;
+        
+        auto it = cache.find(id);
+        if (it != cache.end())
+            return *it->second;
+        
+        Local* local = create();
+        cache.emplace(id, local);
+        return *local;
+    }
+    
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return locals.size();
+    }
+};
+
+} // rpc
+} // coreds
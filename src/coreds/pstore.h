@@ -6,6 +6,8 @@
 
 #include <flatbuffers/flatbuffers.h>
 #include "b64.h"
+#include "util.h"
+#include "ranges.h"
 
 namespace coreds {
 
@@ -111,6 +113,99 @@ private:
     FetchType fetchType { FetchType::NONE };
     
     std::string key_buf;
+    
+    // the ranges held completely, and what the current fetch covers
+    // (only tracked with $fnKeyFB, which reads the keys of the rows)
+    KeyRanges ranges;
+    bool tracking{ false };
+    std::string fetch_key; // the start key (exclusive), or the first visible key for UPDATE
+    std::string fetch_lo;
+    std::string fetch_hi;
+    int fetch_limit{ 0 };
+    int fetch_rows{ 0 };
+    
+    void beginFetch(const ParamRangeKey& prk, const char* key)
+    {
+        if (key)
+            fetch_key.assign(key, 12);
+        else
+            fetch_key.clear();
+        
+        fetch_lo.clear();
+        fetch_hi.clear();
+        fetch_limit = prk.limit;
+        fetch_rows = 0;
+        tracking = $fnKeyFB != nullptr;
+    }
+    /**
+     * Marks the store as loading before $fnFetch, which may complete synchronously (e.g a replayer or cache hit).
+     */
+    bool startFetch(FetchType type, const ParamRangeKey& prk)
+    {
+        fetchType = type;
+        loading_ = true;
+        $fnEvent(EventType::LOADING, true);
+        
+        if ($fnFetch(prk))
+            return true;
+        
+        // not sent (unless already failed from within)
+        cbFetchFailed();
+        return false;
+    }
+    void track(const flatbuffers::Vector<flatbuffers::Offset<F>>* p)
+    {
+        if (!tracking)
+            return;
+        
+        for (int i = 0, len = p == nullptr ? 0 : p->size(); i < len; i++)
+        {
+            const char* key = $fnKeyFB(p->Get(i));
+            if (fetch_lo.empty() || b64::compareKeys(key, fetch_lo.data()) < 0)
+                fetch_lo.assign(key, 12);
+            if (fetch_hi.empty() || b64::compareKeys(key, fetch_hi.data()) > 0)
+                fetch_hi.assign(key, 12);
+        }
+        
+        fetch_rows += p == nullptr ? 0 : p->size();
+    }
+    /**
+     * Records the range the completed fetch covered.
+     * Fewer rows than the limit means there is nothing older, except for ascending fetches,
+     * whose upper end stays open since newer rows keep arriving.
+     */
+    void cover(bool desc)
+    {
+        if (!tracking)
+            return;
+        
+        const char* lo = fetch_rows < fetch_limit ? nullptr : fetch_lo.c_str();
+        if (!desc)
+            ranges.add(fetch_key.c_str(), fetch_rows == 0 ? fetch_key.c_str() : fetch_hi.c_str());
+        else if (!fetch_key.empty())
+            ranges.add(lo, fetch_key.c_str());
+        else if (fetch_rows != 0)
+            ranges.add(lo, fetch_hi.c_str());
+    }
+    /**
+     * Returns the row with key on the visible page (idx set to its slot), or nullptr.
+     */
+    T* visibleRow(const char* key, int& idx)
+    {
+        int size = list.size(),
+            populatePages = page * pageSize,
+            len = std::min(pageSize, size - populatePages),
+            offset;
+        
+        for (idx = 0; idx < len; idx++)
+        {
+            offset = desc_ ? populatePages + idx : size - populatePages - idx - 1;
+            if (0 == memcmp($fnKey(list[offset]), key, 12))
+                return &list[offset];
+        }
+        
+        return nullptr;
+    }
 public:
     std::string errmsg;
     
@@ -140,6 +235,10 @@ public:
     std::function<void(EventType type, bool on)> $fnEvent;
     std::function<void(int idx, T* pojo, int64_t ts)> $fnPopulate;
     std::function<void(std::function<void()> op)> $fnCall;
+    // optional, called by cancelFetch (e.g to cancel the rpc::Token of the request)
+    std::function<void()> $fnCancel;
+    // optional, serializes a row back into its message (see snapshot.h)
+    std::function<flatbuffers::Offset<F>(flatbuffers::FlatBufferBuilder& fbb, const T& pojo)> $fnPack;
     
     PojoStore()
     {
@@ -198,6 +297,37 @@ public:
     {
         return selected_idx;
     }
+    /**
+     * The rows in list order (newest first), regardless of the sort direction.
+     */
+    const std::deque<T>& getList()
+    {
+        return list;
+    }
+    /**
+     * The key ranges known to be held completely (see KeyRanges).
+     */
+    const KeyRanges& getRanges()
+    {
+        return ranges;
+    }
+    /**
+     * Returns true if every row older than the last one is known to be held,
+     * in which case fetchOlder returns false without fetching.
+     */
+    bool isOldestLoaded()
+    {
+        const KeyRanges::Range* known = list.empty() ? nullptr : ranges.find($fnKey(list.back()));
+        return known != nullptr && known->lo.empty();
+    }
+    /**
+     * Forgets the known ranges, e.g when rows were inserted with keys older than the newest
+     * (the next fetches then go to the server in full).
+     */
+    void clearRanges()
+    {
+        ranges.clear();
+    }
     void init(Opts opts)
     {
         pageSize = opts.pageSize;
@@ -237,6 +367,69 @@ public:
         
         return true;
     }
+    /**
+     * Replaces the rows (in list order) and the view state, e.g from a snapshot, then populates.
+     * The row with selected_key (optional) is reselected. Returns false while loading.
+     */
+    bool restore(const flatbuffers::Vector<flatbuffers::Offset<F>>* rows, bool desc, int page,
+            const char* selected_key = nullptr)
+    {
+        if (loading_)
+            return false;
+        
+        list.clear();
+        ranges.clear();
+        selected = nullptr;
+        selected_idx = -1;
+        
+        for (int i = 0, len = rows == nullptr ? 0 : rows->size(); i < len; i++)
+            list.emplace_back(rows->Get(i));
+        
+        if (selected_key)
+        {
+            for (auto& pojo : list)
+            {
+                if (0 == memcmp($fnKey(pojo), selected_key, 12))
+                {
+                    selected = &pojo;
+                    break;
+                }
+            }
+        }
+        
+        bool toggled = desc != desc_;
+        desc_ = desc;
+        // e.g the snapshot was saved with another pageSize (fetchUpdate reads the first row of the page)
+        int last = list.empty() ? 0 : (static_cast<int>(list.size()) - 1) / pageSize;
+        this->page = std::max(0, std::min(page, last));
+        
+        $fnCall($populate);
+        
+        if (toggled)
+            $fnEvent(EventType::DESC, desc_);
+        
+        return true;
+    }
+    /**
+     * Repaints the row of pojo only (e.g after an optimistic MultiCAS::apply or its undo).
+     * Returns false if it is not on the visible page.
+     */
+    bool repaintRow(T* pojo)
+    {
+        int idx;
+        const char* key = $fnKey(*pojo);
+        if (nullptr == visibleRow(key, idx))
+            return false;
+        
+        // rows may move or go away before the call runs, so it is found again by key
+        std::string k(key, 12);
+        $fnCall([this, k]() {
+            int idx;
+            if (T* row = visibleRow(k.data(), idx))
+                $fnPopulate(idx, row, util::CoarseClock::shared().now());
+        });
+        return true;
+    }
     void repaint()
     {
         $fnCall($populate);
@@ -275,7 +468,8 @@ public:
         page_vcount = len;
         page_count = (size - 1) / pageSize;
         
-        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        // coarse: ticked by the event loop, one read per repaint
+        int64_t now = util::CoarseClock::shared().now();
         
         // reset
         this->selected_idx = selected_idx;
@@ -302,6 +496,9 @@ public:
         int updateLen = updateList == nullptr ? 0 : updateList->size();
         if (updateLen == 0)
         {
+            // removed rows leave the known ranges stale
+            ranges.clear();
+            
             if (size <= pageSize)
             {
                 list.clear();
@@ -381,6 +578,9 @@ public:
                 list.emplace_front(updateList->Get(i));
         }
         
+        if (removed != 0)
+            ranges.clear();
+        
         // TODO check if current page is affected before you populate
         $fnCall($populate);
         return removed != 0;
@@ -417,6 +617,18 @@ public:
         // TODO check if current page is affected before you populate
         $fnCall($populate);
     }
+    /**
+     * Abandons the fetch in progress (e.g when navigating away).
+     */
+    bool cancelFetch() {
+        if (fetchType == FetchType::NONE)
+            return false;
+        
+        if ($fnCancel != nullptr)
+            $fnCancel();
+        
+        return cbFetchFailed();
+    }
     bool cbFetchFailed() {
         if (fetchType == FetchType::NONE)
             return false;
@@ -430,6 +642,8 @@ public:
         if (fetchType == FetchType::NONE)
             return false;
         
+        track(p);
+        
         switch (fetchType)
         {
             case FetchType::NEWER:
@@ -452,6 +666,9 @@ public:
                 break;
         }
         
+        // after update(), which forgets the ranges when rows were removed
+        cover(fetchType == FetchType::OLDER || (fetchType == FetchType::NEWER ? fetch_key.empty() : desc_));
+        
         fetchType = FetchType::NONE;
         loading_ = false;
         $fnEvent(EventType::LOADING, false);
@@ -474,13 +691,14 @@ public:
         prk.limit = empty ? pageSize * multiplier + 1 : (desc_ ? pageSize : pageSize * multiplier);
         prk.start_key = empty ? nullptr : $fnKey(list.front());
         
-        if (!$fnFetch(prk))
-            return false;
+        // skip what is already known to hold nothing newer (e.g rows deleted since)
+        const KeyRanges::Range* known = empty ? nullptr : ranges.find(prk.start_key);
+        if (known != nullptr && 0 != memcmp(known->hi.data(), prk.start_key, 12))
+            prk.start_key = known->hi.c_str();
         
-        fetchType = FetchType::NEWER;
-        loading_ = true;
-        $fnEvent(EventType::LOADING, true);
-        return true;
+        beginFetch(prk, prk.start_key);
+        prk.start_key = empty ? nullptr : fetch_key.c_str();
+        return startFetch(FetchType::NEWER, prk);
     }
     bool fetchOlder()
     {
@@ -493,13 +711,20 @@ public:
         //prk.start_key = $fnKey(desc_ ? list.back() : list.front());
         prk.start_key = $fnKey(list.back());
         
-        if (!$fnFetch(prk))
-            return false;
+        const KeyRanges::Range* known = ranges.find(prk.start_key);
+        if (known != nullptr && 0 != known->lo.compare(0, 12, prk.start_key, 12))
+        {
+            // everything older is already held, answered locally (see isOldestLoaded)
+            if (known->lo.empty())
+                return false;
+            
+            // only fetch past the known gap
+            prk.start_key = known->lo.c_str();
+        }
         
-        fetchType = FetchType::OLDER;
-        loading_ = true;
-        $fnEvent(EventType::LOADING, true);
-        return true;
+        beginFetch(prk, prk.start_key);
+        prk.start_key = fetch_key.c_str();
+        return startFetch(FetchType::OLDER, prk);
     }
     bool fetch(bool newer)
     {
@@ -530,13 +755,8 @@ public:
         prk.limit = std::min(pageSize, static_cast<int>(list.size()));
         prk.start_key = key_buf.c_str();
         
-        if (!$fnFetch(prk))
-            return false;
-        
-        fetchType = FetchType::UPDATE;
-        loading_ = true;
-        $fnEvent(EventType::LOADING, true);
-        return true;
+        beginFetch(prk, $fnKey(pojo));
+        return startFetch(FetchType::UPDATE, prk);
     }
     bool appendPageInfoTo(std::string& buf)
     {
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "b64.h"
+
+namespace coreds {
+
+/**
+ * Sorted, disjoint [lo, hi] ranges of keys (12 chars) known to be fetched completely,
+ * i.e every row the server had in a range at the time is held by the store.
+ * An empty lo means the range is open below (nothing older exists).
+ * Overlapping ranges are merged as they are added.
+ */
+struct KeyRanges
+{
+    struct Range
+    {
+        std::string lo;
+        std::string hi;
+    };
+
+private:
+    std::vector<Range> ranges;
+    
+    // an empty key is the lowest
+    static int compare(const std::string& a, const char* b)
+    {
+        if (a.empty())
+            return b == nullptr ? 0 : -1;
+        if (b == nullptr)
+            return 1;
+        
+        return b64::compareKeys(a.data(), b);
+    }
+
+public:
+    bool empty() const
+    {
+        return ranges.empty();
+    }
+    size_t size() const
+    {
+        return ranges.size();
+    }
+    const std::vector<Range>& list() const
+    {
+        return ranges;
+    }
+    void clear()
+    {
+        ranges.clear();
+    }
+    
+    /**
+     * Adds [lo, hi], where lo is nullptr if open below.
+     */
+    void add(const char* lo, const char* hi)
+    {
+        Range r;
+        if (lo != nullptr)
+            r.lo.assign(lo, 12);
+        r.hi.assign(hi, 12);
+        
+        if (compare(r.hi, lo) < 0)
+            return;
+        
+        // the first range that does not end before lo
+        auto it = ranges.begin();
+        while (it != ranges.end() && compare(it->hi, lo) < 0)
+            ++it;
+        
+        auto first = it;
+        for (; it != ranges.end() && compare(it->lo, hi) <= 0; ++it)
+        {
+            if (it->lo.empty() || (!r.lo.empty() && compare(it->lo, r.lo.data()) < 0))
+                r.lo.swap(it->lo);
+            if (compare(it->hi, r.hi.data()) > 0)
+                r.hi.swap(it->hi);
+        }
+        
+        it = ranges.erase(first, it);
+        ranges.insert(it, std::move(r));
+    }
+    
+    /**
+     * Returns the range containing key, or nullptr.
+     */
+    const Range* find(const char* key) const
+    {
+        // the last range that starts at or before key
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), key, [](const char* k, const Range& r) {
+            return compare(r.lo, k) > 0;
+        });
+        
+        if (it == ranges.begin())
+            return nullptr;
+        
+        --it;
+        return compare(it->hi, key) >= 0 ? &*it : nullptr;
+    }
+    
+    /**
+     * Returns true if [lo, hi] lies within a single range (lo is nullptr if open below).
+     */
+    bool covers(const char* lo, const char* hi) const
+    {
+        const Range* r = find(hi);
+        return r != nullptr && (r->lo.empty() || (lo != nullptr && compare(r->lo, lo) <= 0));
+    }
+};
+
+} // coreds
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+#include "mmap.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * The log is a magic followed by 8-byte aligned records (native byte order):
+ * RecordHeader, then uri, request body, content-encoding, etag and response body back to back.
+ * The response body is kept as received (possibly compressed).
+ */
+const char RECORD_MAGIC[8] = { 'C', 'D', 'S', 'R', 'E', 'C', '1', '\n' };
+
+struct RecordHeader
+{
+    // the whole record, padding included
+    uint32_t size;
+    int32_t status;
+    // since the recorder was opened
+    int64_t sent_ns;
+    // until the full response arrived
+    int64_t latency_ns;
+    uint32_t uri_len;
+    uint32_t body_len;
+    uint32_t encoding_len;
+    uint32_t etag_len;
+    uint32_t response_len;
+    uint32_t reserved;
+};
+
+/**
+ * A record of a mapped log (points into the mapping).
+ */
+struct Record
+{
+    int status;
+    int64_t sent_ns;
+    int64_t latency_ns;
+    const char* uri;
+    size_t uri_len;
+    const char* body;
+    size_t body_len;
+    const char* encoding;
+    size_t encoding_len;
+    const char* etag;
+    size_t etag_len;
+    const char* response;
+    size_t response_len;
+};
+
+/**
+ * Appends request/response pairs to a log (see Base::recorder).
+ * Thread-safe, so one recorder can be shared by several Base instances.
+ */
+struct Recorder
+{
+private:
+    std::FILE* f{ nullptr };
+    std::mutex mutex;
+    int64_t start_ns{ 0 };
+    uint64_t count_{ 0 };
+
+public:
+    Recorder() {}
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+    
+    ~Recorder()
+    {
+        close();
+    }
+    
+    /**
+     * Truncates the file.
+     */
+    bool open(const char* path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (f)
+            std::fclose(f);
+        
+        count_ = 0;
+        start_ns = metrics::nanos();
+        if (nullptr == (f = std::fopen(path, "wb")))
+            return false;
+        
+        if (sizeof(RECORD_MAGIC) == std::fwrite(RECORD_MAGIC, 1, sizeof(RECORD_MAGIC), f))
+            return true;
+        
+        std::fclose(f);
+        f = nullptr;
+        return false;
+    }
+    
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (f)
+        {
+            std::fclose(f);
+            f = nullptr;
+        }
+    }
+    
+    /**
+     * Returns false (and closes the recorder) if the buffered records could not be written.
+     */
+    bool flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!f)
+            return false;
+        
+        if (0 == std::fflush(f))
+            return true;
+        
+        std::fclose(f);
+        f = nullptr;
+        return false;
+    }
+    
+    uint64_t count()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count_;
+    }
+    
+    bool isOpen()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return f != nullptr;
+    }
+    
+    /**
+     * sent_ns is a metrics::nanos() timestamp.
+     * On a failed write (e.g a full disk) the recorder is closed and false is returned,
+     * leaving a truncated last record (ignored by Recording).
+     */
+    bool write(const std::string& uri, const std::string& body, int status,
+            const std::string& encoding, const std::string& etag, const std::string& response,
+            int64_t sent_ns, int64_t latency_ns)
+    {
+        RecordHeader h;
+        size_t len = sizeof(h) + uri.size() + body.size() + encoding.size() + etag.size() + response.size();
+        size_t padding = (8 - len % 8) % 8;
+        
+        h.size = static_cast<uint32_t>(len + padding);
+        h.status = status;
+        h.latency_ns = latency_ns;
+        h.uri_len = static_cast<uint32_t>(uri.size());
+        h.body_len = static_cast<uint32_t>(body.size());
+        h.encoding_len = static_cast<uint32_t>(encoding.size());
+        h.etag_len = static_cast<uint32_t>(etag.size());
+        h.response_len = static_cast<uint32_t>(response.size());
+        h.reserved = 0;
+        
+        static const char zeros[8] = { 0 };
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!f)
+            return false;
+        
+        h.sent_ns = sent_ns - start_ns;
+        if (1 != std::fwrite(&h, sizeof(h), 1, f) ||
+                uri.size() != std::fwrite(uri.data(), 1, uri.size(), f) ||
+                body.size() != std::fwrite(body.data(), 1, body.size(), f) ||
+                encoding.size() != std::fwrite(encoding.data(), 1, encoding.size(), f) ||
+                etag.size() != std::fwrite(etag.data(), 1, etag.size(), f) ||
+                response.size() != std::fwrite(response.data(), 1, response.size(), f) ||
+                padding != std::fwrite(zeros, 1, padding, f))
+        {
+            std::fclose(f);
+            f = nullptr;
+            return false;
+        }
+        
+        count_++;
+        return true;
+    }
+};
+
+/**
+ * A memory-mapped log written by a Recorder.
+ */
+struct Recording
+{
+private:
+    util::MappedFile file;
+    std::vector<Record> records;
+
+public:
+    /**
+     * Returns false if the file is not a log. A truncated last record (e.g the recording process crashed) is ignored.
+     */
+    bool open(const char* path)
+    {
+        records.clear();
+        if (!file.open(path) || file.size() < sizeof(RECORD_MAGIC) ||
+                0 != std::memcmp(file.data(), RECORD_MAGIC, sizeof(RECORD_MAGIC)))
+        {
+            file.close();
+            return false;
+        }
+        
+        const uint8_t* end = file.data() + file.size();
+        for (const uint8_t* p = file.data() + sizeof(RECORD_MAGIC); end - p >= static_cast<ptrdiff_t>(sizeof(RecordHeader));)
+        {
+            RecordHeader h;
+            std::memcpy(&h, p, sizeof(h));
+            
+            size_t len = sizeof(h) + static_cast<size_t>(h.uri_len) + h.body_len + h.encoding_len + h.etag_len + h.response_len;
+            if (h.size < len || static_cast<size_t>(end - p) < h.size)
+                break;
+            
+            const char* s = reinterpret_cast<const char*>(p + sizeof(h));
+            Record r;
+            r.status = h.status;
+            r.sent_ns = h.sent_ns;
+            r.latency_ns = h.latency_ns;
+            r.uri = s;
+            r.uri_len = h.uri_len;
+            r.body = r.uri + r.uri_len;
+            r.body_len = h.body_len;
+            r.encoding = r.body + r.body_len;
+            r.encoding_len = h.encoding_len;
+            r.etag = r.encoding + r.encoding_len;
+            r.etag_len = h.etag_len;
+            r.response = r.etag + r.etag_len;
+            r.response_len = h.response_len;
+            records.push_back(r);
+            
+            p += h.size;
+        }
+        
+        return true;
+    }
+    
+    size_t size() const
+    {
+        return records.size();
+    }
+    const Record& operator[](size_t i) const
+    {
+        return records[i];
+    }
+};
+
+/**
+ * Serves the responses of a Recording to a Base in replay mode (see Base::replayer), no socket involved.
+ * Each request is matched to the next unused record with the same uri and body, else with the same uri.
+ *
+ * Responses are due at the time of their request plus the recorded latency times time_scale
+ * (0 delivers them as fast as the client consumes them), in request order like a pipelined connection.
+ *
+ * Not thread-safe: post and pump from the same thread.
+ */
+struct Replayer
+{
+    double time_scale{ 1.0 };
+
+private:
+    const Recording& recording;
+    // uri + '\0' + body
+    std::unordered_map<std::string, std::deque<size_t>> by_request;
+    std::unordered_map<std::string, std::deque<size_t>> by_uri;
+    std::vector<bool> used;
+    std::string key_buf;
+    std::string res_buf;
+    
+    struct Pending
+    {
+        int64_t due_ns;
+        // -1 when no record matched
+        int64_t idx;
+    };
+    std::deque<Pending> pending;
+    uint64_t misses_{ 0 };
+    
+    int64_t take(std::deque<size_t>& queue)
+    {
+        while (!queue.empty() && used[queue.front()])
+            queue.pop_front();
+        
+        if (queue.empty())
+            return -1;
+        
+        size_t idx = queue.front();
+        queue.pop_front();
+        used[idx] = true;
+        return static_cast<int64_t>(idx);
+    }
+    
+    void writeResponse(const Pending& p)
+    {
+        if (p.idx == -1)
+        {
+            res_buf.assign("HTTP/1.1 404 Not Found\r\nContent-Length: 22\r\n\r\n-No recorded response.");
+            return;
+        }
+        
+        const Record& r = recording[static_cast<size_t>(p.idx)];
+        res_buf.assign("HTTP/1.1 ");
+        res_buf += std::to_string(r.status);
+        res_buf += " Replayed\r\nContent-Length: ";
+        res_buf += std::to_string(r.response_len);
+        if (r.encoding_len != 0)
+        {
+            res_buf += "\r\nContent-Encoding: ";
+            res_buf.append(r.encoding, r.encoding_len);
+        }
+        if (r.etag_len != 0)
+        {
+            res_buf += "\r\nETag: ";
+            res_buf.append(r.etag, r.etag_len);
+        }
+        res_buf += "\r\n\r\n";
+        res_buf.append(r.response, r.response_len);
+    }
+
+public:
+    Replayer(const Recording& recording) : recording(recording), used(recording.size(), false)
+    {
+        for (size_t i = 0; i < recording.size(); i++)
+        {
+            const Record& r = recording[i];
+            std::string key(r.uri, r.uri_len);
+            by_uri[key].push_back(i);
+            
+            key += '\0';
+            key.append(r.body, r.body_len);
+            by_request[key].push_back(i);
+        }
+    }
+    Replayer(const Replayer&) = delete;
+    Replayer& operator=(const Replayer&) = delete;
+    
+    /**
+     * Requests that matched no record (answered with 404 and an error envelope).
+     */
+    uint64_t misses()
+    {
+        return misses_;
+    }
+    size_t pendingCount()
+    {
+        return pending.size();
+    }
+    
+    void post(const std::string& uri, const std::string& body)
+    {
+        key_buf.assign(uri);
+        key_buf += '\0';
+        key_buf += body;
+        
+        int64_t idx = -1;
+        auto it = by_request.find(key_buf);
+        if (it != by_request.end())
+            idx = take(it->second);
+        
+        auto uit = idx == -1 ? by_uri.find(uri) : by_uri.end();
+        if (uit != by_uri.end())
+            idx = take(uit->second);
+        
+        int64_t due = metrics::nanos();
+        if (idx == -1)
+            misses_++;
+        else
+            due += static_cast<int64_t>(recording[static_cast<size_t>(idx)].latency_ns * time_scale);
+        
+        // in order, like a pipelined connection
+        if (!pending.empty() && pending.back().due_ns > due)
+            due = pending.back().due_ns;
+        
+        pending.push_back({ due, idx });
+    }
+    
+    /**
+     * Returns the raw http response that is due next (waiting for it if wait is set), or nullptr.
+     * The buffer is reused by the next call.
+     */
+    const std::string* next(bool wait)
+    {
+        if (pending.empty())
+            return nullptr;
+        
+        int64_t delay = pending.front().due_ns - metrics::nanos();
+        if (delay > 0)
+        {
+            if (!wait)
+                return nullptr;
+            
+            std::this_thread::sleep_for(std::chrono::nanoseconds(delay));
+        }
+        
+        writeResponse(pending.front());
+        pending.pop_front();
+        return &res_buf;
+    }
+};
+
+} // rpc
+} // coreds
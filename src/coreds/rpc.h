@@ -6,7 +6,27 @@
 #include <brynet/net/http/HttpService.h>
 #include <brynet/net/http/HttpFormat.h>
 
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <deque>
+#include <random>
+#include <unordered_map>
+
 #include "util.h"
+#include "zip.h"
+#include "metrics.h"
+#include "cache.h"
+#include "timer.h"
+#include "mpsc.h"
+#include "balancer.h"
+#include "limiter.h"
+#include "schema.h"
+#include "record.h"
 
 namespace coreds {
 namespace rpc {
@@ -45,8 +65,10 @@ const char* extractMsg(std::string& body)
     return body.data() + colon + 2;
 }
 
-const bool parseJson(std::string& body,
-        const char* root, flatbuffers::Parser& parser, std::string& errmsg)
+/**
+ * Returns true if the body is a success envelope: +[0,...]
+ */
+const bool checkBody(std::string& body, std::string& errmsg)
 {
     bool ok = false;
     if (3 > body.size())
@@ -65,6 +87,22 @@ const bool parseJson(std::string& body,
     {
         errmsg.assign(rpc::extractMsg(body));
     }
+    else
+    {
+        ok = true;
+    }
+    
+    return ok;
+}
+
+const bool parseJson(std::string& body,
+        const char* root, flatbuffers::Parser& parser, std::string& errmsg)
+{
+    bool ok = false;
+    if (!checkBody(body, errmsg))
+    {
+        // errmsg set
+    }
     else if (!root || (parser.SetRootType(root) && parser.ParseJson(rpc::extractJson(body), true)))
     {
         ok = true;
@@ -77,6 +115,30 @@ const bool parseJson(std::string& body,
     return ok;
 }
 
+/**
+ * Same as parseJson, with the root type already resolved (no symbol-table lookup).
+ * A null root means none was requested (only the envelope is checked), not an unknown one.
+ */
+const bool parseJsonTo(std::string& body,
+        flatbuffers::StructDef* root, flatbuffers::Parser& parser, std::string& errmsg)
+{
+    bool ok = false;
+    if (!checkBody(body, errmsg))
+    {
+        // errmsg set
+    }
+    else if (!root || ((parser.root_struct_def_ = root) && parser.ParseJson(rpc::extractJson(body), true)))
+    {
+        ok = true;
+    }
+    else
+    {
+        errmsg.assign(MALFORMED_MESSAGE);
+    }
+    
+    return ok;
+}
+
 /*
 bool fetchInitialTodos(UrlRequest& req, flatbuffers::Parser& parser, std::string& errmsg)
 {
@@ -116,17 +178,29 @@ struct Config
     const int port;
     const bool secure; // ssl
     const char* hostname; // override host that appears in the request header
+    const bool local; // unix domain socket (host is the path)
     
-    Config(const char* host, const int port, const bool secure, const char* hostname = nullptr):
-        host(host), port(port), secure(secure), hostname(hostname) {}
+    Config(const char* host, const int port, const bool secure, const char* hostname = nullptr, const bool local = false):
+        host(host), port(port), secure(secure), hostname(hostname), local(local) {}
         
+    /**
+     * Only the first entry of a comma-separated list is used (see parseList).
+     */
     static const Config parseFrom(char* endpoint, char* hostname = nullptr, int default_nonsecure_port = 0)
     {
+        char* comma = endpoint ? std::strchr(endpoint, ',') : nullptr;
+        if (comma)
+            *comma = '\0';
+        
         int port = 0;
-        bool secure = false;
-        const char* host = coreds::util::resolveEndpoint(endpoint, &port, &secure);
+        bool secure = false, local = false;
+        const char* host = coreds::util::resolveEndpoint(endpoint, &port, &secure, &local);
         
-        if (port != 0)
+        if (local)
+        {
+            return { host, 0, false, hostname, true };
+        }
+        else if (port != 0)
         {
             // provided
         }
@@ -145,6 +219,54 @@ struct Config
         
         return { host, port, secure, hostname };
     }
+    
+    /**
+     * Comma-separated endpoints (e.g replicas for a Balancer), split in place.
+     * Entries that fail to resolve are skipped.
+     */
+    static const std::vector<Config> parseList(char* endpoints, char* hostname = nullptr, int default_nonsecure_port = 0)
+    {
+        std::vector<Config> list;
+        for (char* next; endpoints != nullptr; endpoints = next)
+        {
+            if (nullptr != (next = std::strchr(endpoints, ',')))
+                *next++ = '\0';
+            
+            if ('\0' == *endpoints)
+                continue;
+            
+            Config c = parseFrom(endpoints, hostname, default_nonsecure_port);
+            if (c.host != nullptr)
+                list.push_back(c);
+        }
+        
+        return list;
+    }
+};
+
+/**
+ * Cancels a request: its response is dropped before any parsing.
+ * Can be cancelled from any thread.
+ */
+struct Token
+{
+    typedef std::shared_ptr<Token> PTR;
+    
+    static PTR create()
+    {
+        return std::make_shared<Token>();
+    }
+    
+    void cancel()
+    {
+        cancelled_.store(true, std::memory_order_release);
+    }
+    bool cancelled() const
+    {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+private:
+    std::atomic<bool> cancelled_{ false };
 };
 
 struct Base : brynet::NonCopyable
@@ -154,18 +276,116 @@ struct Base : brynet::NonCopyable
     flatbuffers::Parser parser;
     std::string errmsg;
     std::string req_host;
+    // requests with a body at least this size are sent gzipped (0 disables)
+    size_t gzip_min_size{ 0 };
+    // advertise gzip/deflate for responses, which must then be read with readBody
+    bool accept_compressed{ false };
+    // a compressed response that inflates to more is failed (MALFORMED_MESSAGE)
+    size_t max_inflated_size{ zip::DEFAULT_MAX_OUTPUT };
+    // optional, set before connecting
+    metrics::Registry* metrics{ nullptr };
+    
+    // reconnect (with exponential backoff and jitter) when the connection drops,
+    // replaying the idempotent requests that did not get a response.
+    bool auto_reconnect{ false };
+    int reconnect_min_ms{ 100 };
+    int reconnect_max_ms{ 10000 };
+    
+    // optional, used by postCached
+    ResponseCache* cache{ nullptr };
+    
+    // optional, the requests and failures of this endpoint are reported to it
+    Balancer* balancer{ nullptr };
+    size_t balancer_slot{ 0 };
+    
+    // optional, used by submit (its slots are released here, as responses arrive or requests fail)
+    Limiter* limiter{ nullptr };
+    
+    // optional, every request and its response are appended to it
+    Recorder* recorder{ nullptr };
+    // replay mode: responses come from it instead of a connection (see openReplay)
+    Replayer* replayer{ nullptr };
     
 private:
     std::string req_buf;
+    std::string zip_buf;
+    std::string res_buf;
+    zip::Deflater deflater;
+    zip::Inflater inflater;
     brynet::net::WrapTcpService service;
     bool started{ false };
+    bool connected_once{ false };
+    
+    struct Sent
+    {
+        int key; // metrics
+        int64_t ts; // metrics
+        bool idempotent;
+        // only kept for replay
+        std::string uri;
+        std::string body;
+        // postCached
+        std::string cache_key;
+        // postWithin
+        Token::PTR token;
+        util::TimerWheel::Id timer;
+        int64_t deadline;
+        std::function<void()> on_timeout;
+        // balancer
+        int64_t start_ms;
+        // recorder
+        int64_t sent_ns;
+        // holds a limiter slot
+        bool limited;
+        
+        Sent(int key, int64_t ts, bool idempotent) :
+            key(key), ts(ts), idempotent(idempotent), timer(0), deadline(0), start_ms(0), sent_ns(0), limited(false) {}
+    };
+    
+    // the requests awaiting a response, in order
+    std::deque<Sent> sent;
+    std::deque<Sent> replay;
+    // the entry of the last request posted (in sent or replay)
+    Sent* posted{ nullptr };
+    // set while a submitted request is being sent: the next post takes the limiter slot
+    bool limiting{ false };
+    std::unordered_map<std::string, int> metric_keys;
+    int cur_key{ -1 };
+    std::string cur_cache_key;
+    
+    std::minstd_rand rng{ static_cast<unsigned>(util::now()) };
+    int backoff_ms{ 0 };
+    int64_t reconnect_at{ 0 };
+    
+    util::TimerWheel timers;
+    
+    // tasks from other threads, drained on the loop
+    util::TaskQueue tasks;
+    std::function<void()> $drainTasks{
+        [this]() { tasks.drain(); }
+    };
+    
+    int metricKey(const std::string& uri)
+    {
+        auto it = metric_keys.find(uri);
+        if (it != metric_keys.end())
+            return it->second;
+        
+        int key = metrics->key(uri);
+        metric_keys.emplace(uri, key);
+        return key;
+    }
     
 protected:
     int fd{ SOCKET_ERROR };
     
     Base(const Config config) : config(config), host(config.host)
     {
-        if (config.port == 80 && !config.secure)
+        if (config.local)
+        {
+            req_host.assign(config.hostname ? config.hostname : "localhost");
+        }
+        else if (config.port == 80 && !config.secure)
         {
             req_host.assign(config.hostname ? config.hostname : host);
         }
@@ -184,9 +404,30 @@ protected:
             SSL_library_init();
     }
     
-    void post(const brynet::net::HttpSession::PTR& session,
-            const std::string& uri, const std::string& body)
+    /**
+     * Idempotent requests are replayed after a reconnect if no response arrived (when auto_reconnect is set).
+     * While disconnected they are queued, and their response arrives once reconnected.
+     * Returns false if the request was dropped (no connection, and not queued):
+     * no response will arrive for it, so the caller must fail it.
+     */
+    bool post(const brynet::net::HttpSession::PTR& session,
+            const std::string& uri, const std::string& body, bool idempotent = false,
+            const std::string* etag = nullptr)
     {
+        if (!replayer && (!session || (auto_reconnect && !isConnected())))
+        {
+            if (!auto_reconnect || !idempotent)
+                return false;
+            
+            // sent once reconnected
+            replay.emplace_back(-1, 0, true);
+            replay.back().uri = uri;
+            replay.back().body = body;
+            posted = &replay.back();
+            take();
+            return true;
+        }
+        
         /*
         brynet::net::HttpRequest req;
         
@@ -200,21 +441,233 @@ protected:
         session->send(payload.data(), payload.size());
         */
         
+        int64_t start = metrics ? metrics::nanos() : 0;
+        
         req_buf.assign("POST ");
         req_buf += uri;
         req_buf += " HTTP/1.1\r\nHost: ";
         req_buf += req_host;
-        req_buf += "\r\nContent-Type: application/json\r\nContent-Length: ";
-        req_buf += std::to_string(body.size());
-        req_buf += "\r\n\r\n";
-        req_buf += body;
+        req_buf += "\r\nContent-Type: application/json\r\n";
+        
+        if (accept_compressed)
+            req_buf += "Accept-Encoding: gzip, deflate\r\n";
+        
+        if (etag)
+        {
+            req_buf += "If-None-Match: ";
+            req_buf += *etag;
+            req_buf += "\r\n";
+        }
+        
+        if (gzip_min_size != 0 && body.size() >= gzip_min_size && deflater.compress(zip_buf, body.data(), body.size()))
+        {
+            req_buf += "Content-Encoding: gzip\r\nContent-Length: ";
+            req_buf += std::to_string(zip_buf.size());
+            req_buf += "\r\n\r\n";
+            req_buf += zip_buf;
+        }
+        else
+        {
+            req_buf += "Content-Length: ";
+            req_buf += std::to_string(body.size());
+            req_buf += "\r\n\r\n";
+            req_buf += body;
+        }
+        
+        if (replayer)
+            replayer->post(uri, body);
+        else
+            session->send(req_buf.data(), req_buf.size());
+        
+        if (metrics)
+        {
+            int key = metricKey(uri);
+            int64_t ts = metrics::nanos();
+            metrics->record(key, metrics::Stage::SEND, ts - start);
+            metrics->inc(key, metrics::Counter::REQUESTS);
+            metrics->inc(key, metrics::Counter::BYTES_OUT, req_buf.size());
+            sent.emplace_back(key, ts, idempotent);
+        }
+        else
+        {
+            sent.emplace_back(-1, 0, idempotent);
+        }
+        
+        if ((idempotent && auto_reconnect) || recorder)
+        {
+            sent.back().uri = uri;
+            sent.back().body = body;
+        }
+        
+        if (recorder)
+            sent.back().sent_ns = metrics::nanos();
+        
+        if (balancer)
+        {
+            sent.back().start_ms = util::now();
+            balancer->onStart(balancer_slot);
+        }
+        
+        posted = &sent.back();
+        take();
+        return true;
+    }
+    
+    /**
+     * Posts with a deadline (0 for none) and/or a cancellation token.
+     * On expiry the token is cancelled and on_timeout is called (e.g PojoStore::cbFetchFailed),
+     * as they are when the connection drops and the request is not replayed.
+     * The response of a cancelled request is dropped before onHttpData.
+     * The deadline (and token) also hold while an idempotent request is queued for replay.
+     */
+    bool postWithin(const brynet::net::HttpSession::PTR& session,
+            const std::string& uri, const std::string& body, int timeout_ms,
+            Token::PTR token = nullptr, std::function<void()> on_timeout = nullptr, bool idempotent = false)
+    {
+        if (!post(session, uri, body, idempotent))
+            return false;
+        
+        if (!token && timeout_ms > 0)
+            token = Token::create();
+        
+        auto& s = *posted;
+        s.token = token;
+        
+        if (timeout_ms > 0)
+        {
+            s.deadline = util::now() + timeout_ms;
+            s.on_timeout = on_timeout;
+            s.timer = timers.add(s.deadline, [token, on_timeout]() {
+                if (token->cancelled())
+                    return;
+                
+                token->cancel();
+                if (on_timeout)
+                    on_timeout();
+            });
+        }
+        
+        return true;
+    }
+    
+    /**
+     * Posts a read, revalidating the cached response (If-None-Match) if there is one.
+     * Handle its response with parseCached.
+     */
+    bool postCached(const brynet::net::HttpSession::PTR& session,
+            const std::string& uri, const std::string& body)
+    {
+        if (!cache)
+            return post(session, uri, body, true);
+        
+        std::string key;
+        ResponseCache::keyTo(key, uri, body);
+        
+        if (!post(session, uri, body, true, cache->etag(key)))
+            return false;
+        
+        posted->cache_key.swap(key);
+        return true;
+    }
+    
+    /**
+     * Sends a request through the limiter (right away without one): send calls post, postWithin or postCached
+     * once, now or when a slot frees up. The slot is held until the response arrives or the request fails.
+     * Returns false if the request was shed (shed is called with OVERLOADED_MESSAGE) or dropped right away.
+     */
+    bool submit(Priority priority, Limiter::Send send, Limiter::Shed shed = nullptr)
+    {
+        if (!limiter)
+            return send();
         
-        session->send(req_buf.data(), req_buf.size());
+        return limiter->submit(priority, [this, send]() {
+            limiting = true;
+            send();
+            
+            // not posted (or dropped): the limiter rolls the slot back
+            bool taken = !limiting;
+            limiting = false;
+            return taken;
+        }, std::move(shed));
+    }
+    
+    /**
+     * Returns the flatbuffer of a postCached response, taken from the cache when the server answers
+     * 304 Not Modified (no transfer, no parsing). Returns nullptr with errmsg set on failure.
+     * The buffer stays valid while held, even if the entry is evicted.
+     * (A 304 for an entry evicted meanwhile never gets here: the request is sent again, unconditionally.)
+     */
+    ResponseCache::Buffer::PTR parseCached(const brynet::net::HTTPParser& httpParser, const char* root)
+    {
+        bool cached = cache && !cur_cache_key.empty();
+        
+        if (cached && 304 == httpParser.getStatusCode())
+        {
+            if (auto e = cache->get(cur_cache_key))
+                return e->data;
+            
+            errmsg.assign(MALFORMED_MESSAGE);
+            return nullptr;
+        }
+        
+        if (!parseBody(readBody(httpParser), root))
+        {
+            if (cached)
+                cache->remove(cur_cache_key);
+            return nullptr;
+        }
+        
+        auto buf = std::make_shared<const ResponseCache::Buffer>(parser.builder_.GetBufferPointer(), parser.builder_.GetSize());
+        if (cached && httpParser.hasKey("ETag"))
+            cache->put(cur_cache_key, httpParser.getValue("ETag"), buf);
+        
+        return buf;
+    }
+    
+    /**
+     * Same as rpc::parseJson (on the member parser and errmsg), recorded under the uri of the response being handled.
+     */
+    const bool parseBody(std::string& body, const char* root)
+    {
+        if (!metrics)
+            return rpc::parseJson(body, root, parser, errmsg);
+        
+        int64_t start = metrics::nanos();
+        bool ok = rpc::parseJson(body, root, parser, errmsg);
+        metrics->record(cur_key, metrics::Stage::PARSE, metrics::nanos() - start);
+        
+        if (!ok && errmsg == MALFORMED_MESSAGE)
+            metrics->inc(cur_key, metrics::Counter::MALFORMED);
+        
+        return ok;
+    }
+    
+    /**
+     * Returns the response body, for parseJson to modify in place: the received one if not encoded (no copy),
+     * else decompressed into a buffer that is reused across responses.
+     * A body that fails to decompress (or exceeds max_inflated_size) is replaced with an error envelope
+     * that parseJson reports.
+     */
+    std::string& readBody(const brynet::net::HTTPParser& httpParser)
+    {
+        const std::string& body = httpParser.getBody();
+        
+        if (!httpParser.hasKey("Content-Encoding") || httpParser.getValue("Content-Encoding") == "identity")
+            return const_cast<std::string&>(body);
+        
+        inflater.max_output = max_inflated_size;
+        if (!inflater.decompress(res_buf, body.data(), body.size()))
+        {
+            res_buf.assign("-");
+            res_buf += MALFORMED_MESSAGE;
+        }
+        
+        return res_buf;
     }
     
     virtual void onLoop(const brynet::net::EventLoop::PTR& loop) = 0;
     std::function<void (const brynet::net::EventLoop::PTR& loop)> $onLoop{
-        std::bind(&Base::onLoop, this, std::placeholders::_1)
+        std::bind(&Base::handleLoop, this, std::placeholders::_1)
     };
     
     void start()
@@ -222,27 +675,261 @@ protected:
         if (!started)
         {
             started = true;
+            util::CoarseClock::shared().start();
             service.startWorkThread(1, $onLoop);
         }
     }
     
     virtual void onHttpData(const brynet::net::HTTPParser& httpParser, const brynet::net::HttpSession::PTR& session) = 0;
     std::function<void (const brynet::net::HTTPParser& httpParser, const brynet::net::HttpSession::PTR& session)> $onHttpData{
-        std::bind(&Base::onHttpData, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&Base::handleHttpData, this, std::placeholders::_1, std::placeholders::_2)
     };
     
     virtual void onHttpClose(const brynet::net::HttpSession::PTR& httpSession) = 0;
     std::function<void (const brynet::net::HttpSession::PTR& httpSession)> $onHttpClose{
-        std::bind(&Base::onHttpClose, this, std::placeholders::_1)
+        std::bind(&Base::handleHttpClose, this, std::placeholders::_1)
     };
     
     virtual void onHttpOpen(const brynet::net::HttpSession::PTR& httpSession) = 0;
     
 private:
+    void handleLoop(const brynet::net::EventLoop::PTR& loop)
+    {
+        int64_t now = util::CoarseClock::shared().tick();
+        
+        tasks.drain();
+        
+        if (!timers.empty())
+            timers.advance(now);
+        
+        if (reconnect_at != 0 && now >= reconnect_at)
+        {
+            reconnect_at = 0;
+            if (!connect(true))
+            {
+                if (balancer)
+                    balancer->onFailure(balancer_slot);
+                scheduleReconnect();
+            }
+        }
+        
+        onLoop(loop);
+    }
+    
+    void scheduleReconnect()
+    {
+        if (backoff_ms == 0)
+            backoff_ms = reconnect_min_ms;
+        else
+            backoff_ms = std::min(backoff_ms * 2, reconnect_max_ms);
+        
+        // equal jitter: half fixed, half random
+        int half = backoff_ms / 2;
+        reconnect_at = util::now() + half + (half == 0 ? 0 : static_cast<int>(rng() % half));
+    }
+    
+    void take()
+    {
+        if (limiting)
+        {
+            posted->limited = true;
+            limiting = false;
+        }
+    }
+    
+    /**
+     * Releases the limiter slot of a request that is done (or will never complete).
+     */
+    void settle(bool limited, bool ok)
+    {
+        if (limited && limiter)
+            limiter->onComplete(ok);
+    }
+    
+    void handleHttpData(const brynet::net::HTTPParser& httpParser, const brynet::net::HttpSession::PTR& session)
+    {
+        if (sent.empty())
+        {
+            onHttpData(httpParser, session);
+            return;
+        }
+        
+        // released once handled (a refetch keeps it)
+        bool limited = sent.front().limited;
+        bool ok = httpParser.getStatusCode() < 500;
+        
+        if (sent.front().timer != 0)
+            timers.cancel(sent.front().timer);
+        
+        if (balancer)
+            balancer->onComplete(balancer_slot, ok, util::now() - sent.front().start_ms);
+        
+        if (recorder)
+            record(httpParser, sent.front());
+        
+        if (sent.front().token && sent.front().token->cancelled())
+        {
+            // timed out or cancelled
+            sent.pop_front();
+            settle(limited, false);
+            return;
+        }
+        
+        if (304 == httpParser.getStatusCode() && !sent.front().cache_key.empty() &&
+                (!cache || !cache->etag(sent.front().cache_key)))
+        {
+            // evicted while revalidating, fetched again in full
+            Sent r = std::move(sent.front());
+            sent.pop_front();
+            refetch(session, r);
+            return;
+        }
+        
+        cur_cache_key.swap(sent.front().cache_key);
+        
+        if (!metrics)
+        {
+            sent.pop_front();
+            onHttpData(httpParser, session);
+            cur_cache_key.clear();
+            settle(limited, ok);
+            return;
+        }
+        
+        int64_t start = metrics::nanos();
+        cur_key = sent.front().key;
+        metrics->record(cur_key, metrics::Stage::RESPONSE, start - sent.front().ts);
+        metrics->inc(cur_key, metrics::Counter::BYTES_IN, httpParser.getBody().size());
+        sent.pop_front();
+        
+        onHttpData(httpParser, session);
+        
+        metrics->record(cur_key, metrics::Stage::CALLBACK, metrics::nanos() - start);
+        cur_key = -1;
+        cur_cache_key.clear();
+        settle(limited, ok);
+    }
+    
+    void record(const brynet::net::HTTPParser& httpParser, const Sent& s)
+    {
+        static const std::string EMPTY;
+        recorder->write(s.uri, s.body, httpParser.getStatusCode(),
+                httpParser.hasKey("Content-Encoding") ? httpParser.getValue("Content-Encoding") : EMPTY,
+                httpParser.hasKey("ETag") ? httpParser.getValue("ETag") : EMPTY,
+                httpParser.getBody(), s.sent_ns, metrics::nanos() - s.sent_ns);
+    }
+    
+    /**
+     * Fails a request that will get no response: its timer is cancelled, then its token and on_timeout
+     * (if not already timed out).
+     */
+    void expire(Sent& s)
+    {
+        if (s.timer != 0)
+            timers.cancel(s.timer);
+        
+        settle(s.limited, false);
+        s.limited = false;
+        
+        if (!s.token || s.token->cancelled())
+            return;
+        
+        s.token->cancel();
+        if (s.on_timeout)
+            s.on_timeout();
+    }
+    
+    void handleHttpClose(const brynet::net::HttpSession::PTR& httpSession)
+    {
+        std::deque<Sent> dropped;
+        dropped.swap(sent);
+        
+        if (balancer)
+            balancer->onFailure(balancer_slot);
+        
+        if (auto_reconnect)
+        {
+            // replayed before anything queued since (their deadlines keep running)
+            for (auto it = dropped.rbegin(); it != dropped.rend(); ++it)
+            {
+                if (it->idempotent)
+                    replay.push_front(std::move(*it));
+            }
+            
+            fd = SOCKET_ERROR;
+            scheduleReconnect();
+        }
+        
+        onHttpClose(httpSession);
+        
+        // no response will arrive for these (after onHttpClose, so that a retry from on_timeout is not sent on this session)
+        for (auto& s : dropped)
+        {
+            if (!(auto_reconnect && s.idempotent))
+                expire(s);
+        }
+    }
+    
+    /**
+     * Sends a request again (a replay, or a refetch), keeping its deadline (with the remaining budget), token and cache key.
+     */
+    void resend(const brynet::net::HttpSession::PTR& session, Sent& r)
+    {
+        // timed out or cancelled meanwhile
+        if (r.token && r.token->cancelled())
+        {
+            settle(r.limited, false);
+            return;
+        }
+        
+        // due, but the timer has not fired yet
+        if (r.deadline != 0 && util::now() >= r.deadline)
+        {
+            expire(r);
+            return;
+        }
+        
+        const std::string* etag = cache && !r.cache_key.empty() ? cache->etag(r.cache_key) : nullptr;
+        
+        if (!post(session, r.uri, r.body, true, etag))
+        {
+            expire(r);
+            return;
+        }
+        
+        // queued again if the connection dropped meanwhile
+        Sent& s = *posted;
+        s.cache_key.swap(r.cache_key);
+        s.token = std::move(r.token);
+        s.timer = r.timer;
+        s.deadline = r.deadline;
+        s.on_timeout = std::move(r.on_timeout);
+        s.limited = r.limited;
+    }
+    
+    /**
+     * Sends a postCached request again (its uri and body are those of the cache key).
+     */
+    void refetch(const brynet::net::HttpSession::PTR& session, Sent& r)
+    {
+        size_t sep = r.cache_key.find('\0');
+        r.uri.assign(r.cache_key, 0, sep);
+        r.body.assign(r.cache_key, sep + 1, std::string::npos);
+        resend(session, r);
+    }
+    
     void setupHttp(const brynet::net::HttpSession::PTR& httpSession)
     {
         httpSession->setCloseCallback($onHttpClose);
         httpSession->setHttpCallback($onHttpData);
+        
+        backoff_ms = 0;
+        
+        std::deque<Sent> pending;
+        pending.swap(replay);
+        for (auto& r : pending)
+            resend(httpSession, r);
+        
         onHttpOpen(httpSession);
     }
     std::function<void (const brynet::net::HttpSession::PTR& httpSession)> $setupHttp{
@@ -257,6 +944,33 @@ private:
         std::bind(&Base::onTcpSession, this, std::placeholders::_1)
     };
     
+    static int connectLocal(const std::string& path)
+    {
+#if defined(_WIN32)
+        return SOCKET_ERROR;
+#else
+        struct sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path))
+            return SOCKET_ERROR;
+        
+        int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+            return SOCKET_ERROR;
+        
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.data(), path.size());
+        
+        if (0 != ::connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)))
+        {
+            ::close(sock);
+            return SOCKET_ERROR;
+        }
+        
+        return sock;
+#endif
+    }
+    
 protected:
     /**
      * Returns true if the connection is successful or if already connected when not forced.
@@ -264,12 +978,24 @@ protected:
     bool connect(bool force = false)
     {
         bool ret = !force && SOCKET_ERROR != fd;
+        int64_t start = metrics ? metrics::nanos() : 0;
         
-        if (!ret && SOCKET_ERROR != (fd = brynet::net::base::Connect(false, host, config.port)))
+        if (!ret && SOCKET_ERROR != (fd = config.local ? connectLocal(host) : brynet::net::base::Connect(false, host, config.port)))
         {
             auto socket = brynet::net::TcpSocket::Create(fd, false);
             service.addSession(std::move(socket), $onTcpSession, config.secure, nullptr, 1024 * 1024, false);
             ret = true;
+            
+            if (metrics)
+            {
+                // connection-level stats are keyed by the request host
+                int key = metricKey(req_host);
+                metrics->record(key, metrics::Stage::CONNECT, metrics::nanos() - start);
+                if (connected_once)
+                    metrics->inc(key, metrics::Counter::RECONNECTS);
+            }
+            
+            connected_once = true;
         }
         
         return ret;
@@ -279,14 +1005,87 @@ protected:
     };
     
 public:
+    virtual ~Base()
+    {
+        stop();
+    }
+    
+    /**
+     * Stops the event loop. Call it from the destructor of a subclass, so that the loop does not
+     * call into it (or into what it owns) while it is being destroyed.
+     */
+    void stop()
+    {
+        if (!started)
+            return;
+        
+        started = false;
+        service.getService()->stopWorkerThread();
+        util::CoarseClock::shared().stop();
+        
+        // queued after the last drain
+        tasks.discard();
+    }
+    
+    /**
+     * Loads a precompiled schema (.bfbs) instead of parsing the .fbs source.
+     */
+    bool loadSchema(const Schema& schema)
+    {
+        return schema.loadInto(parser);
+    }
+    
     bool isConnected()
     {
         return SOCKET_ERROR != fd;
     }
     
+    size_t replayCount()
+    {
+        return replay.size();
+    }
+    
+    /**
+     * Replay mode (replayer set, no connection): calls onHttpOpen with a null session.
+     * Requests posted from then on are answered by pumpReplay, on the calling thread.
+     */
+    void openReplay()
+    {
+        onHttpOpen(nullptr);
+    }
+    
+    /**
+     * Delivers the due responses to onHttpData (including those of requests posted meanwhile),
+     * waiting for each if wait is set. Returns the number delivered.
+     */
+    size_t pumpReplay(bool wait = true)
+    {
+        size_t n = 0;
+        for (const std::string* raw; replayer && nullptr != (raw = replayer->next(wait)); n++)
+        {
+            brynet::net::HTTPParser httpParser(HTTP_RESPONSE);
+            httpParser.tryParse(raw->data(), raw->size());
+            handleHttpData(httpParser, nullptr);
+        }
+        return n;
+    }
+    
+    /**
+     * Thread-safe. The task runs on the event loop; the loop is only woken for the first task of a burst.
+     * The caller owns the node until its run function is called.
+     */
+    void queue(util::Task* task)
+    {
+        if (tasks.push(task))
+            service.getService()->getRandomEventLoop()->pushAsyncProc($drainTasks);
+    }
+    
+    /**
+     * Same as above, with a pooled node (no allocation once the calling thread's pool is warm).
+     */
     void queue(std::function<void()> fn)
     {
-        service.getService()->getRandomEventLoop()->pushAsyncProc(fn);
+        queue(util::FnTask::create(std::move(fn)));
     }
 };
 
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+
+#include "util.h"
+#include "pstore.h"
+
+namespace coreds {
+
+/**
+ * Central queue for the fetches of many PojoStore instances, in place of each calling $fnFetch on its own.
+ *
+ * At most max_inflight requests are out at once. The queued ones go out by rank (from a heap):
+ * visible stores first, then the most recently touched, then in submission order.
+ * A queued request is re-ranked when one of its stores is shown, hidden or touched.
+ * Identical requests (same uri and range) that are outstanding are sent once, and the response is
+ * fanned out to every waiting store through the usual cbFetchSuccess/cbFetchFailed.
+ *
+ * Not thread-safe, meant to be driven from the event loop.
+ */
+struct FetchScheduler
+{
+    typedef uint64_t Id;
+    
+    /**
+     * A store attached to the scheduler.
+     */
+    struct Client
+    {
+        const std::string uri;
+        
+        Client(const std::string& uri, FetchScheduler& scheduler) : uri(uri), scheduler(scheduler) {}
+        
+        bool isVisible()
+        {
+            return visible;
+        }
+        /**
+         * Called by the app as screens show and hide.
+         */
+        void setVisible(bool visible)
+        {
+            this->visible = visible;
+            scheduler.rerank(*this);
+        }
+        int64_t touchedMs()
+        {
+            return touched_ms;
+        }
+        /**
+         * Marks the store as the one the user last interacted with.
+         */
+        void touch()
+        {
+            touched_ms = util::CoarseClock::shared().now();
+            scheduler.rerank(*this);
+        }
+    
+    private:
+        friend struct FetchScheduler;
+        
+        FetchScheduler& scheduler;
+        bool visible{ true };
+        int64_t touched_ms{ 0 };
+        
+        // receives the root of the list response (nullptr on failure)
+        std::function<void(bool ok, const uint8_t* buf)> done;
+        // unhooks the store's $fnFetch and $fnCancel
+        std::function<void()> unhook;
+        // the request it waits on
+        Id waiting{ 0 };
+    };
+    
+    size_t max_inflight{ 4 };
+    
+    // sends the request, its response is reported with complete(id, ...); returns false if it was not sent
+    std::function<bool(Id id, const std::string& uri, const std::string& body)> $fnPost;
+
+private:
+    struct Rank
+    {
+        bool visible;
+        int64_t touched_ms;
+        uint64_t seq;
+    };
+    
+    struct Request
+    {
+        Id id;
+        Rank rank;
+        // bumped on re-rank, so that its older heap entries are skipped
+        uint32_t version{ 0 };
+        std::string key; // uri + '\0' + body
+        std::vector<Client*> waiters;
+        bool inflight{ false };
+    };
+    
+    struct Queued
+    {
+        Rank rank;
+        Id id;
+        uint32_t version;
+    };
+    
+    // stable addresses, since the stores hold on to their client
+    std::list<Client> clients;
+    std::unordered_map<Id, Request> requests;
+    std::unordered_map<std::string, Id> by_key;
+    // the queued requests, best ranked on top (entries of finished, cancelled or re-ranked requests are skipped)
+    std::vector<Queued> heap;
+    std::string key_buf;
+    std::string body_buf;
+    Id next_id{ 0 };
+    uint64_t seq{ 0 };
+    size_t inflight_{ 0 };
+    uint64_t deduped_{ 0 };
+    
+    // the client submitting (its failure is returned, since the store is not loading yet)
+    Client* submitting{ nullptr };
+    bool submit_failed{ false };
+    
+    // clients detached from a done callback are erased once the response is fanned out
+    int finishing{ 0 };
+    std::vector<Client*> detached;
+    
+    static bool ranksBefore(const Rank& a, const Rank& b)
+    {
+        if (a.visible != b.visible)
+            return a.visible;
+        if (a.touched_ms != b.touched_ms)
+            return a.touched_ms > b.touched_ms;
+        
+        return a.seq < b.seq;
+    }
+    
+    // heap order: the best ranked on top
+    static bool ranksAfter(const Queued& a, const Queued& b)
+    {
+        return ranksBefore(b.rank, a.rank);
+    }
+    
+    static Rank rankOf(const Request& r)
+    {
+        Rank rank{ false, 0, r.rank.seq };
+        for (auto c : r.waiters)
+        {
+            rank.visible = rank.visible || c->visible;
+            rank.touched_ms = std::max(rank.touched_ms, c->touched_ms);
+        }
+        return rank;
+    }
+    
+    void enqueue(Request& r)
+    {
+        if (heap.size() > 2 * requests.size() + 16)
+        {
+            // mostly stale, rebuilt from the queued requests
+            heap.clear();
+            for (auto& it : requests)
+            {
+                Request& q = it.second;
+                if (!q.inflight && &q != &r)
+                    heap.push_back({ q.rank, q.id, q.version });
+            }
+            std::make_heap(heap.begin(), heap.end(), ranksAfter);
+        }
+        
+        heap.push_back({ r.rank, r.id, r.version });
+        std::push_heap(heap.begin(), heap.end(), ranksAfter);
+    }
+    
+    /**
+     * Called when the waiters of a queued request (or their visibility/recency) change.
+     */
+    void rerank(Request& r)
+    {
+        if (r.inflight || r.waiters.empty())
+            return;
+        
+        Rank rank = rankOf(r);
+        if (!ranksBefore(rank, r.rank) && !ranksBefore(r.rank, rank))
+            return;
+        
+        r.rank = rank;
+        r.version++;
+        enqueue(r);
+    }
+    
+    void rerank(Client& c)
+    {
+        auto it = c.waiting == 0 ? requests.end() : requests.find(c.waiting);
+        if (it != requests.end())
+            rerank(it->second);
+    }
+    
+    void finish(Request& r, bool ok, const uint8_t* buf)
+    {
+        std::vector<Client*> waiters;
+        waiters.swap(r.waiters);
+        
+        Id id = r.id;
+        by_key.erase(r.key);
+        requests.erase(id);
+        
+        finishing++;
+        for (auto c : waiters)
+        {
+            // detached meanwhile
+            if (c->done == nullptr)
+                continue;
+            
+            c->waiting = 0;
+            if (!ok && c == submitting)
+                submit_failed = true;
+            else
+                c->done(ok, buf);
+        }
+        
+        if (--finishing == 0 && !detached.empty())
+        {
+            for (auto c : detached)
+                erase(*c);
+            
+            detached.clear();
+        }
+    }
+    
+    void erase(Client& c)
+    {
+        clients.remove_if([&c](const Client& it) {
+            return &it == &c;
+        });
+    }
+    
+    /**
+     * Sends the best ranked requests while under the limit.
+     */
+    void pump()
+    {
+        while (inflight_ < max_inflight && !heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), ranksAfter);
+            Queued q = heap.back();
+            heap.pop_back();
+            
+            auto it = requests.find(q.id);
+            if (it == requests.end() || it->second.inflight || it->second.version != q.version)
+                continue;
+            
+            Request* best = &it->second;
+            
+            size_t sep = best->key.find('\0');
+            body_buf.assign(best->key, sep + 1, std::string::npos);
+            
+            best->inflight = true;
+            inflight_++;
+            if (!$fnPost(best->id, best->key.substr(0, sep), body_buf))
+            {
+                inflight_--;
+                finish(*best, false, nullptr);
+            }
+        }
+    }
+    
+    bool submit(Client& c, ParamRangeKey& prk)
+    {
+        if (c.waiting != 0)
+            return false;
+        
+        key_buf.assign(c.uri);
+        key_buf += '\0';
+        prk.stringifyTo(key_buf);
+        
+        auto it = by_key.find(key_buf);
+        if (it != by_key.end())
+        {
+            deduped_++;
+            Request& r = requests[it->second];
+            r.waiters.push_back(&c);
+            c.waiting = it->second;
+            rerank(r);
+            return true;
+        }
+        
+        Id id = ++next_id;
+        Request& r = requests[id];
+        r.id = id;
+        r.key = key_buf;
+        r.waiters.push_back(&c);
+        r.rank.seq = seq++;
+        r.rank = rankOf(r);
+        by_key.emplace(r.key, id);
+        c.waiting = id;
+        enqueue(r);
+        
+        // nested when a callback fetches again
+        Client* prev = submitting;
+        bool prev_failed = submit_failed;
+        
+        submitting = &c;
+        submit_failed = false;
+        pump();
+        
+        bool ok = !submit_failed;
+        submitting = prev;
+        submit_failed = prev_failed;
+        return ok;
+    }
+    
+    void cancel(Client& c)
+    {
+        auto it = requests.find(c.waiting);
+        c.waiting = 0;
+        if (it == requests.end())
+            return;
+        
+        Request& r = it->second;
+        r.waiters.erase(std::remove(r.waiters.begin(), r.waiters.end(), &c), r.waiters.end());
+        
+        // an inflight request completes anyway (its response is dropped)
+        if (r.waiters.empty() && !r.inflight)
+        {
+            by_key.erase(r.key);
+            requests.erase(it);
+        }
+        else
+        {
+            rerank(r);
+        }
+    }
+
+public:
+    FetchScheduler() {}
+    FetchScheduler(const FetchScheduler&) = delete;
+    FetchScheduler& operator=(const FetchScheduler&) = delete;
+    
+    size_t inflightCount()
+    {
+        return inflight_;
+    }
+    size_t queuedCount()
+    {
+        return requests.size() - inflight_;
+    }
+    /**
+     * Fetches that joined an identical outstanding request instead of sending their own.
+     */
+    uint64_t dedupCount()
+    {
+        return deduped_;
+    }
+    
+    /**
+     * Routes the fetches of the store (its $fnFetch and $fnCancel) through the scheduler.
+     * The list response is expected in the usual layout (the rows are the first field of the root).
+     */
+    template <typename T, typename F>
+    Client& attach(PojoStore<T, F>& store, const std::string& uri)
+    {
+        clients.emplace_back(uri, *this);
+        Client& c = clients.back();
+        
+        c.done = [&store](bool ok, const uint8_t* buf) {
+            if (!ok)
+            {
+                store.cbFetchFailed();
+                return;
+            }
+            
+            auto root = buf ? flatbuffers::GetRoot<flatbuffers::Table>(buf) : nullptr;
+            store.cbFetchSuccess(root ? root->GetPointer<const flatbuffers::Vector<flatbuffers::Offset<F>>*>(4) : nullptr);
+        };
+        store.$fnFetch = [this, &c](ParamRangeKey prk) {
+            return submit(c, prk);
+        };
+        store.$fnCancel = [this, &c]() {
+            cancel(c);
+        };
+        c.unhook = [&store]() {
+            store.$fnFetch = [](ParamRangeKey) {
+                return false;
+            };
+            store.$fnCancel = nullptr;
+        };
+        
+        return c;
+    }
+    
+    /**
+     * Cancels the client's request and forgets it (call before its store is destroyed).
+     * The store can no longer fetch (its $fnFetch returns false from then on).
+     */
+    void detach(Client& c)
+    {
+        if (c.done == nullptr)
+            return;
+        
+        cancel(c);
+        c.done = nullptr;
+        c.unhook();
+        c.unhook = nullptr;
+        
+        if (finishing != 0)
+            detached.push_back(&c);
+        else
+            erase(c);
+    }
+    
+    /**
+     * Reports the response of a request: buf is the root of the parsed list (e.g parser.builder_.GetBufferPointer()).
+     * Returns false if the id is unknown.
+     */
+    bool complete(Id id, bool ok, const uint8_t* buf)
+    {
+        auto it = requests.find(id);
+        if (it == requests.end() || !it->second.inflight)
+            return false;
+        
+        inflight_--;
+        finish(it->second, ok, ok ? buf : nullptr);
+        pump();
+        return true;
+    }
+};
+
+} // coreds
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <flatbuffers/idl.h>
+
+#include <cstdint>
+#include <string>
+
+#include "mmap.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * Precompiled binary schema (flatc --binary --schema foo.fbs), either embedded or memory-mapped.
+ * Loading it into a parser skips tokenizing/parsing the .fbs source.
+ *
+ * The bytes are read-only and shared by every parser loaded from it, so the Schema must outlive loadInto().
+ */
+struct Schema
+{
+private:
+    const uint8_t* data_{ nullptr };
+    size_t size_{ 0 };
+    util::MappedFile file;
+
+public:
+    Schema() {}
+    /**
+     * Embedded (e.g a byte array generated from the .bfbs), not copied.
+     */
+    Schema(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+    Schema(const Schema&) = delete;
+    Schema& operator=(const Schema&) = delete;
+    
+    const uint8_t* data() const
+    {
+        return data_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    
+    /**
+     * Maps the .bfbs file (read into memory where mmap is unavailable).
+     */
+    bool open(const char* path)
+    {
+        bool ok = file.open(path);
+        data_ = file.data();
+        size_ = file.size();
+        return ok;
+    }
+    
+    /**
+     * Returns false if the bytes are not a valid binary schema.
+     */
+    bool loadInto(flatbuffers::Parser& parser) const
+    {
+        return size_ != 0 && parser.Deserialize(data_, size_);
+    }
+};
+
+} // rpc
+} // coreds
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include <flatbuffers/flatbuffers.h>
+
+#include "mmap.h"
+#include "pstore.h"
+
+namespace coreds {
+namespace snapshot {
+
+const char* const IDENTIFIER = "CDSS";
+
+/**
+ * The root of a snapshot file, same layout flatc generates for:
+ * table PojoSnapshot { version: uint; desc: bool; page: int; selected: string; rows: [F]; }
+ * root_type PojoSnapshot; file_identifier "CDSS";
+ */
+template <typename F>
+struct Root : flatbuffers::Table
+{
+    typedef flatbuffers::Vector<flatbuffers::Offset<F>> Rows;
+    
+    enum
+    {
+        VT_VERSION = 4,
+        VT_DESC = 6,
+        VT_PAGE = 8,
+        VT_SELECTED = 10,
+        VT_ROWS = 12
+    };
+    
+    uint32_t version() const
+    {
+        return GetField<uint32_t>(VT_VERSION, 0);
+    }
+    bool desc() const
+    {
+        return 0 != GetField<uint8_t>(VT_DESC, 1);
+    }
+    int32_t page() const
+    {
+        return GetField<int32_t>(VT_PAGE, 0);
+    }
+    const flatbuffers::String* selected() const
+    {
+        return GetPointer<const flatbuffers::String*>(VT_SELECTED);
+    }
+    const Rows* rows() const
+    {
+        return GetPointer<const Rows*>(VT_ROWS);
+    }
+    
+    /**
+     * The rows are verified with F::Verify (generated by flatc).
+     */
+    bool Verify(flatbuffers::Verifier& verifier) const
+    {
+        return VerifyTableStart(verifier) &&
+                VerifyField<uint32_t>(verifier, VT_VERSION) &&
+                VerifyField<uint8_t>(verifier, VT_DESC) &&
+                VerifyField<int32_t>(verifier, VT_PAGE) &&
+                VerifyField<flatbuffers::uoffset_t>(verifier, VT_SELECTED) &&
+                verifier.Verify(selected()) &&
+                VerifyField<flatbuffers::uoffset_t>(verifier, VT_ROWS) &&
+                verifier.Verify(rows()) &&
+                verifier.VerifyVectorOfTables(rows()) &&
+                verifier.EndTable();
+    }
+};
+
+/**
+ * Renames from to to, replacing to if it exists (which std::rename does not on Windows).
+ */
+inline bool replaceFile(const char* from, const char* to)
+{
+#if defined(_WIN32)
+    return 0 != MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+#else
+    return 0 == std::rename(from, to);
+#endif
+}
+
+/**
+ * Writes the rows (packed with $fnPack), sort direction, page and selected key of the store.
+ * version is app-defined: bump it when F changes so that older snapshots are rejected.
+ * The file is replaced atomically (written to path.tmp, then renamed).
+ */
+template <typename T, typename F>
+bool save(PojoStore<T, F>& store, const char* path, uint32_t version = 0)
+{
+    if (!store.$fnPack)
+        return false;
+    
+    flatbuffers::FlatBufferBuilder fbb(64 * 1024);
+    
+    const std::deque<T>& list = store.getList();
+    std::vector<flatbuffers::Offset<F>> rows;
+    rows.reserve(list.size());
+    for (auto& pojo : list)
+        rows.push_back(store.$fnPack(fbb, pojo));
+    
+    auto rows_offset = fbb.CreateVector(rows);
+    
+    flatbuffers::Offset<flatbuffers::String> selected_offset;
+    if (T* selected = store.getSelected())
+        selected_offset = fbb.CreateString(store.$fnKey(*selected), 12);
+    
+    auto start = fbb.StartTable();
+    fbb.AddOffset(Root<F>::VT_ROWS, rows_offset);
+    if (!selected_offset.IsNull())
+        fbb.AddOffset(Root<F>::VT_SELECTED, selected_offset);
+    fbb.AddElement<int32_t>(Root<F>::VT_PAGE, store.getPage(), 0);
+    fbb.AddElement<uint32_t>(Root<F>::VT_VERSION, version, 0);
+    fbb.AddElement<uint8_t>(Root<F>::VT_DESC, store.isDesc() ? 1 : 0, 1);
+    fbb.Finish(flatbuffers::Offset<Root<F>>(fbb.EndTable(start)), IDENTIFIER);
+    
+    std::string tmp(path);
+    tmp += ".tmp";
+    
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (f == nullptr)
+        return false;
+    
+    bool ok = fbb.GetSize() == std::fwrite(fbb.GetBufferPointer(), 1, fbb.GetSize(), f);
+    ok = 0 == std::fclose(f) && ok;
+    
+    if (ok && replaceFile(tmp.c_str(), path))
+        return true;
+    
+    std::remove(tmp.c_str());
+    return false;
+}
+
+/**
+ * A mapped snapshot file.
+ */
+template <typename F>
+struct File
+{
+private:
+    util::MappedFile file;
+    const Root<F>* root_{ nullptr };
+
+public:
+    /**
+     * Returns false if the file is missing, corrupt or of another version.
+     */
+    bool open(const char* path, uint32_t version = 0)
+    {
+        root_ = nullptr;
+        if (!file.open(path))
+            return false;
+        
+        flatbuffers::Verifier verifier(file.data(), file.size());
+        if (!verifier.VerifyBuffer<Root<F>>(IDENTIFIER))
+        {
+            file.close();
+            return false;
+        }
+        
+        const Root<F>* root = flatbuffers::GetRoot<Root<F>>(file.data());
+        if (root->version() != version)
+        {
+            file.close();
+            return false;
+        }
+        
+        root_ = root;
+        return true;
+    }
+    
+    void close()
+    {
+        root_ = nullptr;
+        file.close();
+    }
+    
+    /**
+     * Points into the mapping, valid until closed.
+     */
+    const Root<F>* root() const
+    {
+        return root_;
+    }
+};
+
+/**
+ * Warm start: the store is populated from the mapped rows (no parsing), then reconciled
+ * with the server through fetchUpdate if reconcile is set.
+ * The file is unmapped on return, so T must copy what it needs from the message (as it does for responses).
+ * Returns false (leaving the store untouched) if there is no usable snapshot.
+ */
+template <typename T, typename F>
+bool restore(PojoStore<T, F>& store, const char* path, uint32_t version = 0, bool reconcile = true)
+{
+    File<F> file;
+    if (!file.open(path, version))
+        return false;
+    
+    auto root = file.root();
+    auto selected = root->selected();
+    bool ok = store.restore(root->rows(), root->desc(), root->page(),
+            selected && selected->size() == 12 ? selected->c_str() : nullptr);
+    
+    if (ok && reconcile)
+        store.fetchUpdate();
+    
+    return ok;
+}
+
+} // snapshot
+} // coreds
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace coreds {
+namespace util {
+
+/**
+ * Hashed timing wheel: O(1) add/cancel, advance() only visits the slots that elapsed.
+ * Deadlines are in ms (e.g util::now()) and fire with tick_ms resolution.
+ * Not thread-safe, meant to be driven from a single event loop.
+ */
+struct TimerWheel
+{
+    typedef uint64_t Id;
+
+private:
+    struct Timer
+    {
+        Id id;
+        int64_t deadline;
+        std::function<void()> fn;
+    };
+    
+    const int64_t tick_ms;
+    std::vector<std::list<Timer>> slots;
+    std::unordered_map<Id, std::pair<size_t, std::list<Timer>::iterator>> index;
+    std::vector<std::function<void()>> expired;
+    int64_t current{ -1 }; // last tick processed
+    Id next_id{ 0 };
+
+public:
+    TimerWheel(int64_t tick_ms = 10, size_t slot_count = 512) :
+        tick_ms(tick_ms), slots(slot_count) {}
+    
+    bool empty()
+    {
+        return index.empty();
+    }
+    size_t size()
+    {
+        return index.size();
+    }
+    
+    /**
+     * Returns the id to cancel the timer with (never 0).
+     */
+    Id add(int64_t deadline, std::function<void()> fn)
+    {
+        int64_t tick = deadline / tick_ms;
+        if (current == -1)
+            current = tick - 1;
+        else if (tick <= current)
+            tick = current + 1;
+        
+        size_t slot = static_cast<size_t>(tick) % slots.size();
+        auto& list = slots[slot];
+        list.push_back({ ++next_id, deadline, std::move(fn) });
+        index.emplace(next_id, std::make_pair(slot, std::prev(list.end())));
+        return next_id;
+    }
+    
+    /**
+     * Returns false if the timer already fired or was cancelled.
+     */
+    bool cancel(Id id)
+    {
+        auto it = index.find(id);
+        if (it == index.end())
+            return false;
+        
+        slots[it->second.first].erase(it->second.second);
+        index.erase(it);
+        return true;
+    }
+    
+    /**
+     * Fires the timers whose deadline is at or before now.
+     */
+    void advance(int64_t now)
+    {
+        int64_t tick = now / tick_ms;
+        if (current == -1)
+            current = tick - 1;
+        
+        if (tick <= current || index.empty())
+        {
+            current = std::max(current, tick);
+            return;
+        }
+        
+        // a full revolution visits every slot once
+        int64_t last = std::min(tick, current + static_cast<int64_t>(slots.size()));
+        for (int64_t t = current + 1; t <= last; t++)
+        {
+            auto& list = slots[static_cast<size_t>(t) % slots.size()];
+            for (auto it = list.begin(); it != list.end();)
+            {
+                // later revolutions stay in the slot
+                if (it->deadline / tick_ms > tick)
+                {
+                    ++it;
+                    continue;
+                }
+                
+                index.erase(it->id);
+                expired.push_back(std::move(it->fn));
+                it = list.erase(it);
+            }
+        }
+        current = tick;
+        
+        // callbacks may add or cancel timers
+        std::vector<std::function<void()>> fire;
+        fire.swap(expired);
+        for (auto& fn : fire)
+            fn();
+        
+        fire.clear();
+        if (expired.empty())
+            expired.swap(fire);
+    }
+};
+
+} // util
+} // coreds
@@ -0,0 +1,882 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COREDS_TRANSCODE_SSE2
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#include "rpc.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * Builds the flatbuffer of a numeric-key json message ({"1":...,"2":...}) in one pass,
+ * without going through the general-purpose flatbuffers::Parser.
+ *
+ * Keys map straight to field slots through a layout computed once per table:
+ * key n is the field named "n", else the field with id n - 1 (its id attribute, or its declaration order).
+ * Fields are added in the same order as the Parser (by size when the table is sortbysize),
+ * so the output is byte-for-byte the same.
+ *
+ * Anything outside the supported subset (fixed structs, unions, enums as strings, null, unknown keys)
+ * makes transcode() return false, and parseJson() falls back to the Parser.
+ * So does anything the Parser rejects (duplicate keys, control characters in strings), so that both
+ * accept and reject the same inputs.
+ * The result is in parser.builder_, like Parser::ParseJson.
+ */
+struct Transcoder
+{
+    // also parse with the Parser and compare the bytes (e.g over a corpus of recorded responses).
+    // The Parser's output is kept.
+    bool verify{ false };
+    size_t transcoded{ 0 };
+    size_t fallbacks{ 0 };
+    size_t mismatches{ 0 };
+
+private:
+    static const int MAX_DEPTH = 64;
+    
+    struct Slot
+    {
+        bool supported{ false };
+        bool required{ false };
+        flatbuffers::BaseType type{ flatbuffers::BASE_TYPE_NONE };
+        // vectors
+        flatbuffers::BaseType element{ flatbuffers::BASE_TYPE_NONE };
+        // tables and vectors of tables
+        flatbuffers::StructDef* nested{ nullptr };
+        flatbuffers::voffset_t offset{ 0 };
+        // inline size (for sortbysize)
+        size_t size{ 0 };
+        int64_t idef{ 0 };
+        uint64_t udef{ 0 };
+        double fdef{ 0 };
+    };
+    
+    struct Layout
+    {
+        // by key - 1
+        std::vector<Slot> slots;
+        bool sortbysize;
+        bool has_required{ false };
+        // a required field without a slot can never be set
+        bool unreachable{ false };
+    };
+    
+    union Scalar
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+        float f;
+        flatbuffers::uoffset_t off;
+    };
+    
+    struct Value
+    {
+        // null for vector elements
+        const Slot* slot;
+        flatbuffers::BaseType type;
+        Scalar v;
+    };
+    
+    flatbuffers::Parser& parser;
+    std::unordered_map<const flatbuffers::StructDef*, std::unique_ptr<Layout>> layouts;
+    std::vector<Value> stack;
+    std::string scratch;
+    std::string verify_buf;
+    const char* p{ nullptr };
+    const char* end{ nullptr };
+    int depth{ 0 };
+    
+    static size_t sizeOf(flatbuffers::BaseType type)
+    {
+        switch (type)
+        {
+            case flatbuffers::BASE_TYPE_BOOL:
+            case flatbuffers::BASE_TYPE_UTYPE:
+            case flatbuffers::BASE_TYPE_CHAR:
+            case flatbuffers::BASE_TYPE_UCHAR:
+                return 1;
+            case flatbuffers::BASE_TYPE_SHORT:
+            case flatbuffers::BASE_TYPE_USHORT:
+                return 2;
+            case flatbuffers::BASE_TYPE_LONG:
+            case flatbuffers::BASE_TYPE_ULONG:
+            case flatbuffers::BASE_TYPE_DOUBLE:
+                return 8;
+            default:
+                // 32-bit scalars and offsets
+                return 4;
+        }
+    }
+    
+    static bool isNumber(const char* s, const char* e)
+    {
+        for (; s != e; s++)
+        {
+            if ((*s < '0' || *s > '9') && *s != '-' && *s != '+' && *s != '.' && *s != 'e' && *s != 'E')
+                return false;
+        }
+        return true;
+    }
+    
+    static bool isScalar(flatbuffers::BaseType type)
+    {
+        return type >= flatbuffers::BASE_TYPE_BOOL && type <= flatbuffers::BASE_TYPE_DOUBLE;
+    }
+    
+    static void initSlot(Slot& s, flatbuffers::FieldDef* f)
+    {
+        auto& type = f->value.type;
+        s.type = type.base_type;
+        s.offset = f->value.offset;
+        s.required = f->required;
+        s.size = sizeOf(type.base_type);
+        
+        if (isScalar(type.base_type))
+        {
+            const char* c = f->value.constant.c_str();
+            s.supported = true;
+            if (type.base_type == flatbuffers::BASE_TYPE_FLOAT || type.base_type == flatbuffers::BASE_TYPE_DOUBLE)
+                s.fdef = std::strtod(c, nullptr);
+            else if (type.base_type == flatbuffers::BASE_TYPE_ULONG)
+                s.udef = std::strtoull(c, nullptr, 10);
+            else if (0 == std::strcmp(c, "true"))
+                s.idef = 1;
+            else
+                s.idef = std::strtoll(c, nullptr, 10);
+            return;
+        }
+        
+        switch (type.base_type)
+        {
+            case flatbuffers::BASE_TYPE_STRING:
+                s.supported = true;
+                break;
+            case flatbuffers::BASE_TYPE_STRUCT:
+                // fixed structs are stored inline
+                s.supported = !type.struct_def->fixed;
+                s.nested = type.struct_def;
+                break;
+            case flatbuffers::BASE_TYPE_VECTOR:
+                s.element = type.element;
+                s.nested = type.struct_def;
+                s.supported = (isScalar(type.element) && type.element != flatbuffers::BASE_TYPE_UTYPE) ||
+                        type.element == flatbuffers::BASE_TYPE_STRING ||
+                        (type.element == flatbuffers::BASE_TYPE_STRUCT && !type.struct_def->fixed);
+                break;
+            default:
+                // unions
+                break;
+        }
+    }
+    
+    /**
+     * The id attribute, else the id the Parser assigned from the declaration order (the vtable slot).
+     */
+    static size_t idOf(const flatbuffers::FieldDef* f)
+    {
+        auto id = f->attributes.Lookup("id");
+        if (id != nullptr)
+            return std::strtoul(id->constant.c_str(), nullptr, 10);
+        
+        return f->value.offset / sizeof(flatbuffers::voffset_t) - 2;
+    }
+    
+    Layout* layoutOf(flatbuffers::StructDef* def)
+    {
+        auto it = layouts.find(def);
+        if (it != layouts.end())
+            return it->second.get();
+        
+        Layout* layout = new Layout();
+        layouts.emplace(def, std::unique_ptr<Layout>(layout));
+        
+        auto& fields = def->fields.vec;
+        layout->sortbysize = def->sortbysize;
+        layout->slots.resize(fields.size());
+        
+        std::vector<flatbuffers::FieldDef*> by_name(fields.size()), by_id(fields.size());
+        for (size_t n = 1; n <= fields.size(); n++)
+            by_name[n - 1] = def->fields.Lookup(std::to_string(n));
+        for (auto fd : fields)
+        {
+            size_t id = idOf(fd);
+            // unless a key already names it
+            if (id < by_id.size() && by_name.end() == std::find(by_name.begin(), by_name.end(), fd))
+                by_id[id] = fd;
+        }
+        
+        for (size_t n = 1; n <= fields.size(); n++)
+        {
+            flatbuffers::FieldDef* f = by_name[n - 1] != nullptr ? by_name[n - 1] : by_id[n - 1];
+            if (f != nullptr && !f->deprecated)
+                initSlot(layout->slots[n - 1], f);
+        }
+        
+        size_t required = 0, mapped = 0;
+        for (auto fd : fields)
+        {
+            if (fd->required)
+                required++;
+        }
+        for (auto& s : layout->slots)
+        {
+            if (s.required)
+                mapped++;
+        }
+        layout->has_required = mapped != 0;
+        layout->unreachable = mapped != required;
+        
+        return layout;
+    }
+    
+    static int lowestBit(int mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, static_cast<unsigned long>(mask));
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(static_cast<unsigned>(mask));
+#endif
+    }
+    
+    static bool isControl(char c)
+    {
+        return static_cast<unsigned char>(c) < 0x20;
+    }
+    
+    /**
+     * Returns the position of the next quote, backslash or control character (or end), 16 bytes at a time with sse2.
+     */
+    static const char* scanString(const char* s, const char* end)
+    {
+#if defined(COREDS_TRANSCODE_SSE2)
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        for (; s + 16 <= end; s += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+            // unsigned chunk <= 0x1F
+            __m128i below = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control);
+            int mask = _mm_movemask_epi8(_mm_or_si128(below,
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash))));
+            if (mask != 0)
+                return s + lowestBit(mask);
+        }
+#endif
+        while (s != end && *s != '"' && *s != '\\' && !isControl(*s))
+            s++;
+        return s;
+    }
+    
+    void skipWs()
+    {
+        while (p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            p++;
+    }
+    
+    bool expect(char c)
+    {
+        skipWs();
+        if (p == end || *p != c)
+            return false;
+        
+        p++;
+        return true;
+    }
+    
+    bool hex4(uint32_t& cp)
+    {
+        if (end - p < 4)
+            return false;
+        
+        cp = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            char c = *p++;
+            cp <<= 4;
+            if (c >= '0' && c <= '9')
+                cp |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                cp |= c - 'A' + 10;
+            else
+                return false;
+        }
+        return true;
+    }
+    
+    void appendUtf8(uint32_t cp)
+    {
+        if (cp < 0x80)
+        {
+            scratch += static_cast<char>(cp);
+        }
+        else if (cp < 0x800)
+        {
+            scratch += static_cast<char>(0xC0 | (cp >> 6));
+            scratch += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            scratch += static_cast<char>(0xE0 | (cp >> 12));
+            scratch += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            scratch += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            scratch += static_cast<char>(0xF0 | (cp >> 18));
+            scratch += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            scratch += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            scratch += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+    
+    bool parseString(flatbuffers::uoffset_t& off)
+    {
+        if (p == end || *p != '"')
+            return false;
+        
+        const char* start = ++p;
+        p = scanString(p, end);
+        // unescaped control characters are rejected, as by the Parser
+        if (p == end || isControl(*p))
+            return false;
+        
+        if (*p == '"')
+        {
+            // no escapes, straight from the input
+            off = parser.builder_.CreateString(start, p - start).o;
+            p++;
+            return true;
+        }
+        
+        scratch.assign(start, p - start);
+        uint32_t cp, low;
+        while (p != end)
+        {
+            if (*p == '"')
+            {
+                off = parser.builder_.CreateString(scratch.data(), scratch.size()).o;
+                p++;
+                return true;
+            }
+            
+            if (isControl(*p))
+                return false;
+            
+            if (*p != '\\')
+            {
+                start = p;
+                p = scanString(p, end);
+                scratch.append(start, p - start);
+                continue;
+            }
+            
+            if (++p == end)
+                return false;
+            
+            switch (*p++)
+            {
+                case '"': scratch += '"'; break;
+                case '\\': scratch += '\\'; break;
+                case '/': scratch += '/'; break;
+                case 'b': scratch += '\b'; break;
+                case 'f': scratch += '\f'; break;
+                case 'n': scratch += '\n'; break;
+                case 'r': scratch += '\r'; break;
+                case 't': scratch += '\t'; break;
+                case 'u':
+                    if (!hex4(cp) || (cp >= 0xDC00 && cp <= 0xDFFF))
+                        return false;
+                    
+                    if (cp >= 0xD800 && cp <= 0xDBFF)
+                    {
+                        // surrogate pair
+                        if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                            return false;
+                        
+                        p += 2;
+                        if (!hex4(low) || low < 0xDC00 || low > 0xDFFF)
+                            return false;
+                        
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(cp);
+                    break;
+                default:
+                    return false;
+            }
+        }
+        
+        return false;
+    }
+    
+    bool parseScalar(flatbuffers::BaseType type, Scalar& v)
+    {
+        if (p == end)
+            return false;
+        
+        if (type == flatbuffers::BASE_TYPE_BOOL)
+        {
+            if (end - p >= 4 && 0 == std::memcmp(p, "true", 4))
+            {
+                v.i = 1;
+                p += 4;
+                return true;
+            }
+            if (end - p >= 5 && 0 == std::memcmp(p, "false", 5))
+            {
+                v.i = 0;
+                p += 5;
+                return true;
+            }
+            return false;
+        }
+        
+        // a digit must follow the sign (no -inf, -nan)
+        const char* digit = *p == '-' ? p + 1 : p;
+        if (digit == end || *digit < '0' || *digit > '9')
+            return false;
+        
+        char* e;
+        if (type == flatbuffers::BASE_TYPE_FLOAT || type == flatbuffers::BASE_TYPE_DOUBLE)
+        {
+            // the input is nul-terminated (after the message), strtod stops there at the latest
+            if (type == flatbuffers::BASE_TYPE_FLOAT)
+                v.f = std::strtof(p, &e);
+            else
+                v.d = std::strtod(p, &e);
+            
+            // json numbers only (strtod also takes hex, e.g 0x1p3)
+            if (e > end || !isNumber(p, e))
+                return false;
+            
+            p = e;
+            return true;
+        }
+        
+        bool neg = *p == '-';
+        if (neg)
+            p++;
+        
+        uint64_t n = 0;
+        const char* start = p;
+        for (unsigned d; p != end && (d = static_cast<unsigned>(*p - '0')) <= 9; p++)
+        {
+            if (n > (std::numeric_limits<uint64_t>::max() - d) / 10)
+                return false;
+            n = n * 10 + d;
+        }
+        
+        if (p == start || (p != end && (*p == '.' || *p == 'e' || *p == 'E')))
+            return false;
+        
+        if (type == flatbuffers::BASE_TYPE_ULONG)
+        {
+            v.u = n;
+            return !neg || n == 0;
+        }
+        
+        if (neg)
+        {
+            if (n > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + 1)
+                return false;
+            v.i = n == 0 ? 0 : -static_cast<int64_t>(n - 1) - 1;
+        }
+        else
+        {
+            if (n > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+                return false;
+            v.i = static_cast<int64_t>(n);
+        }
+        
+        switch (type)
+        {
+            case flatbuffers::BASE_TYPE_UTYPE:
+            case flatbuffers::BASE_TYPE_UCHAR:
+                return inRange<uint8_t>(v.i);
+            case flatbuffers::BASE_TYPE_CHAR:
+                return inRange<int8_t>(v.i);
+            case flatbuffers::BASE_TYPE_SHORT:
+                return inRange<int16_t>(v.i);
+            case flatbuffers::BASE_TYPE_USHORT:
+                return inRange<uint16_t>(v.i);
+            case flatbuffers::BASE_TYPE_INT:
+                return inRange<int32_t>(v.i);
+            case flatbuffers::BASE_TYPE_UINT:
+                return inRange<uint32_t>(v.i);
+            default:
+                return true;
+        }
+    }
+    
+    template <typename T>
+    static bool inRange(int64_t i)
+    {
+        return i >= static_cast<int64_t>(std::numeric_limits<T>::min()) &&
+                i <= static_cast<int64_t>(std::numeric_limits<T>::max());
+    }
+    
+    bool parseValue(flatbuffers::BaseType type, flatbuffers::StructDef* nested, Scalar& v)
+    {
+        switch (type)
+        {
+            case flatbuffers::BASE_TYPE_STRING:
+                return parseString(v.off);
+            case flatbuffers::BASE_TYPE_STRUCT:
+                return p != end && *p == '{' && parseTable(layoutOf(nested), v.off);
+            default:
+                return parseScalar(type, v);
+        }
+    }
+    
+    bool parseVector(const Slot& s, flatbuffers::uoffset_t& off)
+    {
+        if (p == end || *p != '[')
+            return false;
+        
+        p++;
+        size_t base = stack.size();
+        skipWs();
+        if (p != end && *p == ']')
+        {
+            p++;
+        }
+        else
+        {
+            for (;;)
+            {
+                skipWs();
+                Value value{ nullptr, s.element, {} };
+                if (!parseValue(s.element, s.nested, value.v))
+                    return false;
+                
+                stack.push_back(value);
+                skipWs();
+                if (p == end)
+                    return false;
+                if (*p == ',')
+                {
+                    p++;
+                    continue;
+                }
+                if (*p++ == ']')
+                    break;
+                return false;
+            }
+        }
+        
+        auto& builder = parser.builder_;
+        size_t count = stack.size() - base;
+        builder.StartVector(count, sizeOf(s.element));
+        for (size_t i = stack.size(); i-- > base;)
+            pushElement(stack[i]);
+        
+        off = builder.EndVector(count);
+        stack.resize(base);
+        return true;
+    }
+    
+    void pushElement(const Value& value)
+    {
+        auto& builder = parser.builder_;
+        auto& v = value.v;
+        switch (value.type)
+        {
+            case flatbuffers::BASE_TYPE_BOOL:
+            case flatbuffers::BASE_TYPE_UTYPE:
+            case flatbuffers::BASE_TYPE_UCHAR:
+                builder.PushElement(static_cast<uint8_t>(v.i));
+                break;
+            case flatbuffers::BASE_TYPE_CHAR:
+                builder.PushElement(static_cast<int8_t>(v.i));
+                break;
+            case flatbuffers::BASE_TYPE_SHORT:
+                builder.PushElement(static_cast<int16_t>(v.i));
+                break;
+            case flatbuffers::BASE_TYPE_USHORT:
+                builder.PushElement(static_cast<uint16_t>(v.i));
+                break;
+            case flatbuffers::BASE_TYPE_INT:
+                builder.PushElement(static_cast<int32_t>(v.i));
+                break;
+            case flatbuffers::BASE_TYPE_UINT:
+                builder.PushElement(static_cast<uint32_t>(v.i));
+                break;
+            case flatbuffers::BASE_TYPE_LONG:
+                builder.PushElement(v.i);
+                break;
+            case flatbuffers::BASE_TYPE_ULONG:
+                builder.PushElement(v.u);
+                break;
+            case flatbuffers::BASE_TYPE_FLOAT:
+                builder.PushElement(v.f);
+                break;
+            case flatbuffers::BASE_TYPE_DOUBLE:
+                builder.PushElement(v.d);
+                break;
+            default:
+                builder.PushElement(flatbuffers::Offset<void>(v.off));
+                break;
+        }
+    }
+    
+    void addField(const Value& value)
+    {
+        auto& builder = parser.builder_;
+        auto& s = *value.slot;
+        auto& v = value.v;
+        switch (value.type)
+        {
+            case flatbuffers::BASE_TYPE_BOOL:
+            case flatbuffers::BASE_TYPE_UTYPE:
+            case flatbuffers::BASE_TYPE_UCHAR:
+                builder.AddElement(s.offset, static_cast<uint8_t>(v.i), static_cast<uint8_t>(s.idef));
+                break;
+            case flatbuffers::BASE_TYPE_CHAR:
+                builder.AddElement(s.offset, static_cast<int8_t>(v.i), static_cast<int8_t>(s.idef));
+                break;
+            case flatbuffers::BASE_TYPE_SHORT:
+                builder.AddElement(s.offset, static_cast<int16_t>(v.i), static_cast<int16_t>(s.idef));
+                break;
+            case flatbuffers::BASE_TYPE_USHORT:
+                builder.AddElement(s.offset, static_cast<uint16_t>(v.i), static_cast<uint16_t>(s.idef));
+                break;
+            case flatbuffers::BASE_TYPE_INT:
+                builder.AddElement(s.offset, static_cast<int32_t>(v.i), static_cast<int32_t>(s.idef));
+                break;
+            case flatbuffers::BASE_TYPE_UINT:
+                builder.AddElement(s.offset, static_cast<uint32_t>(v.i), static_cast<uint32_t>(s.idef));
+                break;
+            case flatbuffers::BASE_TYPE_LONG:
+                builder.AddElement(s.offset, v.i, s.idef);
+                break;
+            case flatbuffers::BASE_TYPE_ULONG:
+                builder.AddElement(s.offset, v.u, s.udef);
+                break;
+            case flatbuffers::BASE_TYPE_FLOAT:
+                builder.AddElement(s.offset, v.f, static_cast<float>(s.fdef));
+                break;
+            case flatbuffers::BASE_TYPE_DOUBLE:
+                builder.AddElement(s.offset, v.d, s.fdef);
+                break;
+            default:
+                builder.AddOffset(s.offset, flatbuffers::Offset<void>(v.off));
+                break;
+        }
+    }
+    
+    /**
+     * Whether the table being parsed (its fields from base on the stack) already has the slot (duplicate key).
+     */
+    bool isSet(const Slot* s, size_t base)
+    {
+        for (size_t i = base; i < stack.size(); i++)
+        {
+            if (stack[i].slot == s)
+                return true;
+        }
+        return false;
+    }
+    
+    bool hasRequired(const Layout* layout, size_t base)
+    {
+        for (auto& s : layout->slots)
+        {
+            if (!s.required)
+                continue;
+            
+            if (!isSet(&s, base))
+                return false;
+        }
+        return true;
+    }
+    
+    bool parseTable(Layout* layout, flatbuffers::uoffset_t& off)
+    {
+        if (layout->unreachable || ++depth > MAX_DEPTH)
+            return false;
+        
+        // {
+        p++;
+        size_t base = stack.size();
+        skipWs();
+        if (p != end && *p == '}')
+        {
+            p++;
+        }
+        else
+        {
+            for (;;)
+            {
+                skipWs();
+                if (p == end || *p++ != '"')
+                    return false;
+                
+                size_t key = 0;
+                const char* start = p;
+                for (unsigned d; p != end && (d = static_cast<unsigned>(*p - '0')) <= 9 && p - start < 9; p++)
+                    key = key * 10 + d;
+                
+                if (p == start || p == end || *p++ != '"' || *start == '0' || key > layout->slots.size())
+                    return false;
+                
+                const Slot& s = layout->slots[key - 1];
+                if (!s.supported || isSet(&s, base) || !expect(':'))
+                    return false;
+                
+                skipWs();
+                Value value{ &s, s.type, {} };
+                if (s.type == flatbuffers::BASE_TYPE_VECTOR)
+                {
+                    if (!parseVector(s, value.v.off))
+                        return false;
+                }
+                else if (!parseValue(s.type, s.nested, value.v))
+                {
+                    return false;
+                }
+                
+                stack.push_back(value);
+                skipWs();
+                if (p == end)
+                    return false;
+                if (*p == ',')
+                {
+                    p++;
+                    continue;
+                }
+                if (*p++ == '}')
+                    break;
+                return false;
+            }
+        }
+        
+        if (layout->has_required && !hasRequired(layout, base))
+            return false;
+        
+        // same order as the Parser: backwards, and by size when sortbysize
+        auto& builder = parser.builder_;
+        auto start = builder.StartTable();
+        for (size_t size = layout->sortbysize ? sizeof(flatbuffers::largest_scalar_t) : 1; size; size /= 2)
+        {
+            for (size_t i = stack.size(); i-- > base;)
+            {
+                if (!layout->sortbysize || size == stack[i].slot->size)
+                    addField(stack[i]);
+            }
+        }
+        
+        off = builder.EndTable(start);
+        stack.resize(base);
+        depth--;
+        return true;
+    }
+
+public:
+    Transcoder(flatbuffers::Parser& parser) : parser(parser) {}
+    Transcoder(const Transcoder&) = delete;
+    Transcoder& operator=(const Transcoder&) = delete;
+    
+    /**
+     * Call after loading more schema into the parser (the layouts are computed once per table).
+     */
+    void clear()
+    {
+        layouts.clear();
+    }
+    
+    /**
+     * json must be nul-terminated at json + len.
+     * Returns false (with the builder in an unspecified state) if the message is outside the supported subset.
+     */
+    bool transcode(const char* json, size_t len, flatbuffers::StructDef* root)
+    {
+        if (root == nullptr || root->fixed)
+            return false;
+        
+        p = json;
+        end = json + len;
+        depth = 0;
+        stack.clear();
+        parser.builder_.Clear();
+        
+        flatbuffers::uoffset_t off;
+        skipWs();
+        if (p == end || *p != '{' || !parseTable(layoutOf(root), off))
+            return false;
+        
+        skipWs();
+        if (p != end)
+            return false;
+        
+        parser.builder_.Finish(flatbuffers::Offset<flatbuffers::Table>(off),
+                parser.file_identifier_.empty() ? nullptr : parser.file_identifier_.c_str());
+        return true;
+    }
+    
+    /**
+     * Same as rpc::parseJsonTo, transcoding when possible.
+     */
+    const bool parseJson(std::string& body, flatbuffers::StructDef* root, std::string& errmsg)
+    {
+        if (!checkBody(body, errmsg))
+            return false;
+        
+        if (!root)
+            return true;
+        
+        // +[0,...]
+        size_t len = body.size() - 5;
+        const char* json = rpc::extractJson(body);
+        parser.root_struct_def_ = root;
+        
+        bool ok;
+        if (body.size() > 5 && transcode(json, len, root))
+        {
+            transcoded++;
+            if (!verify)
+                return true;
+            
+            auto& builder = parser.builder_;
+            verify_buf.assign(reinterpret_cast<const char*>(builder.GetBufferPointer()), builder.GetSize());
+            ok = parser.ParseJson(json, true);
+            if (!ok || builder.GetSize() != verify_buf.size() ||
+                    0 != std::memcmp(builder.GetBufferPointer(), verify_buf.data(), verify_buf.size()))
+            {
+                mismatches++;
+            }
+        }
+        else
+        {
+            fallbacks++;
+            ok = parser.ParseJson(json, true);
+        }
+        
+        if (!ok)
+            errmsg.assign(MALFORMED_MESSAGE);
+        
+        return ok;
+    }
+};
+
+} // rpc
+} // coreds
@@ -2,8 +2,11 @@
 
 #include <cstring>
 #include <string>
+#include <vector>
 
+#include <atomic>
 #include <chrono>
+#include <mutex>
 
 namespace coreds {
 
@@ -43,14 +46,25 @@ const char* resolveIpPort(char* arg, int* port)
     return arg;
 }
 
-const char* resolveEndpoint(char* arg, int* port, bool* secure)
+/**
+ * Also accepts unix:///path/to.sock, where local is set and the path is returned.
+ */
+const char* resolveEndpoint(char* arg, int* port, bool* secure, bool* local)
 {
+    *local = false;
     if (arg == nullptr)
     {
         *secure = false;
         return DEFAULT_HOST;
     }
     
+    if (0 == std::strncmp(arg, "unix://", 7))
+    {
+        *secure = false;
+        *local = true;
+        return '/' == arg[7] ? arg + 7 : nullptr;
+    }
+    
     char* slash = std::strchr(arg, '/');
     if (slash == nullptr)
     {
@@ -80,6 +94,16 @@ const char* resolveEndpoint(char* arg, int* port, bool* secure)
     return resolveIpPort(arg, port);
 }
 
+/**
+ * TCP only: a unix:// endpoint is rejected (nullptr), since its path is no host.
+ */
+const char* resolveEndpoint(char* arg, int* port, bool* secure)
+{
+    bool local;
+    const char* host = resolveEndpoint(arg, port, secure, &local);
+    return local ? nullptr : host;
+}
+
 static constexpr uint64_t SECONDS_IN_MINUTE = 60;
 static constexpr uint64_t SECONDS_IN_HOUR = SECONDS_IN_MINUTE * 60;
 static constexpr uint64_t SECONDS_IN_DAY = SECONDS_IN_HOUR * 24;
@@ -87,73 +111,197 @@ static constexpr uint64_t SECONDS_IN_MONTH = SECONDS_IN_DAY * 30;
 static constexpr uint64_t SECONDS_IN_YEAR = SECONDS_IN_DAY * 365;
 static constexpr uint64_t SECONDS_IN_WEEK = SECONDS_IN_DAY * 7;
 
-static int appendTo(std::string& str, int seconds, int count,
-        const std::string& singular,
-        const std::string& plural = "")
+inline int64_t now()
 {
-    long r = static_cast<unsigned>(seconds) / count;
-    if (!r)
-        return seconds;
-    
-    if (!str.empty() && str[str.length() -1] != '-')
-        str += ", ";
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A cached ms timestamp (system clock) for hot paths that only need coarse time (e.g PojoStore::populate).
+ * Refreshed by tick(), which rpc::Base calls on every iteration of its event loop (at least every loop timeout).
+ * Only ticks between start() and the matching stop() are kept: with no loop running, the time is 0
+ * and now() reads the clock directly, so it never serves the time a stopped loop left behind.
+ */
+struct CoarseClock
+{
+private:
+    std::atomic<int64_t> ms{ 0 };
+    std::mutex mutex;
+    int loops{ 0 };
+
+public:
+    static CoarseClock& shared()
+    {
+        static CoarseClock clock;
+        return clock;
+    }
     
-    str += std::to_string(r);
-    str += ' ';
-    if (r < 2)
+    /**
+     * Called by each loop that ticks, before its first tick.
+     */
+    void start()
     {
-        str += singular;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (0 == loops++)
+            ms.store(util::now(), std::memory_order_relaxed);
     }
-    else if (plural.empty())
+    
+    /**
+     * Called once a loop no longer ticks.
+     */
+    void stop()
     {
-        str += singular;
-        str += 's';
+        std::lock_guard<std::mutex> lock(mutex);
+        if (0 == --loops)
+            ms.store(0, std::memory_order_relaxed);
     }
-    else
+    
+    int64_t tick()
     {
-        str += plural;
+        int64_t ts = util::now();
+        // dropped once stopped (a tick racing the last stop() does not bring the time back)
+        for (int64_t cur = ms.load(std::memory_order_relaxed); cur != 0 && !ms.compare_exchange_weak(cur, ts, std::memory_order_relaxed);)
+        {
+            // retry
+        }
+        return ts;
     }
     
-    return static_cast<unsigned>(seconds) % count;
-}
+    int64_t now() const
+    {
+        int64_t ts = ms.load(std::memory_order_relaxed);
+        return ts != 0 ? ts : util::now();
+    }
+};
 
-inline int64_t now()
+/**
+ * Memoized relative time: the text of every bucket (e.g "3 hours ago", "1 day from now") is built once, up front,
+ * so formatting a row is a lookup and an append (no allocation once the target has capacity).
+ * Only the largest unit is rendered. Immutable after construction, so the shared instance is thread-safe.
+ */
+struct Timeago
 {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-}
+private:
+    struct Unit
+    {
+        uint64_t seconds;
+        const char* name;
+        // the counts that fit before the next larger unit (years are capped, then built on the fly)
+        int max;
+    };
+    
+    static const Unit* units()
+    {
+        static const Unit list[] = {
+            { SECONDS_IN_YEAR, "year", 100 },
+            { SECONDS_IN_MONTH, "month", 12 },
+            { SECONDS_IN_WEEK, "week", 4 },
+            { SECONDS_IN_DAY, "day", 6 },
+            { SECONDS_IN_HOUR, "hour", 23 },
+            { SECONDS_IN_MINUTE, "minute", 59 },
+            { 1, "second", 59 }
+        };
+        return list;
+    }
+    static constexpr int UNIT_COUNT = 7;
+    
+    const std::string just{ "just moments ago" };
+    // past then future, each unit's counts back to back starting at offsets[unit]
+    std::vector<std::string> texts[2];
+    int offsets[UNIT_COUNT];
+    
+    static void build(std::string& str, uint64_t count, const Unit& unit, bool future)
+    {
+        char digits[20];
+        int n = 0;
+        for (uint64_t c = count; n == 0 || c != 0; c /= 10)
+            digits[n++] = static_cast<char>('0' + c % 10);
+        
+        while (n != 0)
+            str += digits[--n];
+        
+        str += ' ';
+        str += unit.name;
+        if (count != 1)
+            str += 's';
+        
+        str += future ? " from now" : " ago";
+    }
 
-void appendTimeagoTo(std::string& str, uint64_t ts,
-    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())
-{
-    size_t prev = str.size();
-    int64_t diff = now - ts;
-    if (diff == 0)
+public:
+    Timeago()
     {
-        str += "just moments ago";
-        return;
+        const Unit* u = units();
+        int total = 0;
+        for (int i = 0; i < UNIT_COUNT; i++)
+        {
+            offsets[i] = total;
+            total += u[i].max;
+        }
+        
+        for (int f = 0; f < 2; f++)
+        {
+            texts[f].reserve(total);
+            for (int i = 0; i < UNIT_COUNT; i++)
+            {
+                for (int count = 1; count <= u[i].max; count++)
+                {
+                    texts[f].emplace_back();
+                    build(texts[f].back(), count, u[i], f == 1);
+                }
+            }
+        }
     }
     
-    int seconds = diff / 1000;
-    if (seconds < 0)
-        seconds = -seconds;
+    static const Timeago& shared()
+    {
+        static const Timeago instance;
+        return instance;
+    }
     
-    // TODO: l10n i18n?
-    if (-1 != (seconds = appendTo(str, seconds, SECONDS_IN_YEAR, "year")) && str.empty() &&
-            -1 != (seconds = appendTo(str, seconds, SECONDS_IN_MONTH, "month")) && str.empty() &&
-            -1 != (seconds = appendTo(str, seconds, SECONDS_IN_WEEK, "week")) && str.empty() &&
-            -1 != (seconds = appendTo(str, seconds, SECONDS_IN_DAY, "day")) && str.empty() &&
-            -1 != (seconds = appendTo(str, seconds, SECONDS_IN_HOUR, "hour")) && str.empty() &&
-            -1 != (seconds = appendTo(str, seconds, SECONDS_IN_MINUTE, "minute")) && str.empty())
+    /**
+     * Returns the memoized text, or nullptr past the cached years (appendTo builds those).
+     */
+    const std::string* find(uint64_t ts, int64_t now) const
     {
-        appendTo(str, seconds, 1, "second");
+        int64_t diff = now - static_cast<int64_t>(ts);
+        uint64_t seconds = static_cast<uint64_t>(diff < 0 ? -diff : diff) / 1000;
+        if (seconds == 0)
+            return &just;
+        
+        const Unit* u = units();
+        int i = 0;
+        while (seconds < u[i].seconds)
+            i++;
+        
+        uint64_t count = seconds / u[i].seconds;
+        if (count > static_cast<uint64_t>(u[i].max))
+            return nullptr;
+        
+        return &texts[diff < 0 ? 1 : 0][offsets[i] + count - 1];
     }
     
-    if (prev == str.size())
-        str += "just moments ago";
-    else if (diff < 0)
-        str += " from now";
-    else
-        str += " ago";
+    void appendTo(std::string& str, uint64_t ts, int64_t now) const
+    {
+        if (const std::string* text = find(ts, now))
+        {
+            str += *text;
+            return;
+        }
+        
+        int64_t diff = now - static_cast<int64_t>(ts);
+        uint64_t seconds = static_cast<uint64_t>(diff < 0 ? -diff : diff) / 1000;
+        build(str, seconds / SECONDS_IN_YEAR, units()[0], diff < 0);
+    }
+};
+
+/**
+ * Appends the largest unit of the elapsed time (e.g "3 hours ago"), see Timeago.
+ */
+void appendTimeagoTo(std::string& str, uint64_t ts,
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())
+{
+    Timeago::shared().appendTo(str, ts, now);
 }
 
 } // util
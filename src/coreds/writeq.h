@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util.h"
+#include "mc.h"
+
+namespace coreds {
+namespace rpc {
+
+/**
+ * Coalesces the MultiCAS edits of an entity (by key) until a quiet period (debounce_ms) passes,
+ * max_wait_ms elapsed since its first edit, or max_pending entities are waiting.
+ * Edits of the same field merge into one, keeping the earliest old value and the latest new value;
+ * a field that ends up unchanged is dropped, and so is the request of an entity with nothing left.
+ *
+ * Only the entities that are due are posted (the others keep coalescing), except by flush().
+ * Each gets one request, without waiting for the previous ones (pipelined).
+ * Responses are matched in order through onResponse, like Batch.
+ * Not thread-safe, meant to be driven from the event loop (e.g Base::queue).
+ */
+struct WriteQueue : MultiCAS::Visitor
+{
+    typedef std::function<void(bool ok, const std::string& errmsg)> Callback;
+    
+    int debounce_ms{ 300 };
+    int max_wait_ms{ 2000 };
+    size_t max_pending{ 32 };
+    
+    // builds the request from the merged edits (e.g {"1":key,"2":mc}) and posts it,
+    // returns false if it was not sent
+    std::function<bool(const std::string& key, MultiCAS& mc)> $fnPost;
+    // runs op after delay_ms on the event loop (e.g a util::TimerWheel)
+    std::function<void(int delay_ms, std::function<void()> op)> $fnDelay;
+
+private:
+    struct Edit
+    {
+        int type; // MultiCAS::FN_*
+        int f;
+        std::string s_new, s_old;
+        int64_t i_new, i_old;
+        double d_new, d_old;
+        
+        bool noop() const
+        {
+            return s_new == s_old && i_new == i_old && d_new == d_old;
+        }
+    };
+    
+    struct Entity
+    {
+        std::string key;
+        std::vector<Edit> edits;
+        std::vector<Callback> callbacks;
+        int64_t first_ms;
+        int64_t last_ms;
+    };
+    
+    // in order of first edit
+    std::deque<Entity> pending;
+    std::unordered_map<std::string, size_t> index;
+    std::deque<std::vector<Callback>> inflight;
+    // the edits of the MultiCAS being added, latest first
+    std::vector<Edit> scratch;
+    bool scheduled{ false };
+    
+    uint64_t edits_{ 0 };
+    uint64_t posted_{ 0 };
+    uint64_t dropped_{ 0 };
+    
+    void visitBool(int f, bool newVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_BOOL, f, std::string(), std::string(), newVal, !newVal, 0, 0 });
+    }
+    void visitBytes(int f, const std::string& newVal, const std::string& oldVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_BYTES, f, newVal, oldVal, 0, 0, 0, 0 });
+    }
+    void visitString(int f, const std::string& newVal, const std::string& oldVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_STRING, f, newVal, oldVal, 0, 0, 0, 0 });
+    }
+    void visitDouble(int f, double newVal, double oldVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_DOUBLE, f, std::string(), std::string(), 0, 0, newVal, oldVal });
+    }
+    void visitInt32(int f, int newVal, int oldVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_INT32, f, std::string(), std::string(), newVal, oldVal, 0, 0 });
+    }
+    void visitFixed32(int f, int32_t newVal, int32_t oldVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_FIXED32, f, std::string(), std::string(), newVal, oldVal, 0, 0 });
+    }
+    void visitFixed64(int f, int64_t newVal, int64_t oldVal) override
+    {
+        scratch.push_back({ MultiCAS::FN_FIXED64, f, std::string(), std::string(), newVal, oldVal, 0, 0 });
+    }
+    
+    static void merge(Entity& e, Edit& edit)
+    {
+        for (auto& existing : e.edits)
+        {
+            if (existing.type != edit.type || existing.f != edit.f)
+                continue;
+            
+            // keep the earliest old value
+            existing.s_new.swap(edit.s_new);
+            existing.i_new = edit.i_new;
+            existing.d_new = edit.d_new;
+            return;
+        }
+        
+        e.edits.push_back(std::move(edit));
+    }
+    
+    static void addTo(MultiCAS& mc, const Edit& edit)
+    {
+        switch (edit.type)
+        {
+            case MultiCAS::FN_BOOL:
+                mc.add(edit.f, edit.i_new != 0);
+                break;
+            case MultiCAS::FN_BYTES:
+                mc.addBytes(edit.f, &edit.s_new, &edit.s_old);
+                break;
+            case MultiCAS::FN_STRING:
+                mc.add(edit.f, &edit.s_new, &edit.s_old);
+                break;
+            case MultiCAS::FN_DOUBLE:
+                mc.add(edit.f, edit.d_new, edit.d_old);
+                break;
+            case MultiCAS::FN_INT32:
+                mc.addInt32(edit.f, static_cast<int>(edit.i_new), static_cast<int>(edit.i_old));
+                break;
+            case MultiCAS::FN_FIXED32:
+                mc.addFixed32(edit.f, static_cast<int32_t>(edit.i_new), static_cast<int32_t>(edit.i_old));
+                break;
+            case MultiCAS::FN_FIXED64:
+                mc.addFixed64(edit.f, edit.i_new, edit.i_old);
+                break;
+        }
+    }
+    
+    void schedule(int delay_ms)
+    {
+        if (scheduled || $fnDelay == nullptr)
+            return;
+        
+        scheduled = true;
+        $fnDelay(delay_ms, $check);
+    }
+    
+    int64_t dueOf(const Entity& e)
+    {
+        return std::min(e.last_ms + debounce_ms, e.first_ms + max_wait_ms);
+    }
+    
+    void check()
+    {
+        scheduled = false;
+        if (!pending.empty())
+            flushDue(0);
+    }
+    const std::function<void()> $check{
+        std::bind(&WriteQueue::check, this)
+    };
+    
+    /**
+     * Posts the entities that are due, plus the oldest ones regardless (over max_pending),
+     * and waits for the next one due.
+     */
+    void flushDue(size_t oldest)
+    {
+        int64_t now = util::CoarseClock::shared().now(), next = INT64_MAX;
+        std::deque<Entity> list, rest;
+        for (auto& e : pending)
+        {
+            int64_t due = dueOf(e);
+            if (oldest != 0)
+            {
+                oldest--;
+                list.push_back(std::move(e));
+            }
+            else if (now >= due)
+            {
+                list.push_back(std::move(e));
+            }
+            else
+            {
+                next = std::min(next, due);
+                rest.push_back(std::move(e));
+            }
+        }
+        
+        pending.swap(rest);
+        index.clear();
+        for (size_t i = 0; i < pending.size(); i++)
+            index.emplace(pending[i].key, i);
+        
+        if (!pending.empty())
+            schedule(static_cast<int>(next - now));
+        
+        // after the queue is consistent, callbacks may add edits
+        post(list);
+    }
+    
+    void post(std::deque<Entity>& list)
+    {
+        MultiCAS mc;
+        for (auto& e : list)
+        {
+            for (auto& edit : e.edits)
+            {
+                if (!edit.noop())
+                    addTo(mc, edit);
+            }
+            
+            if (mc.empty())
+            {
+                dropped_++;
+                for (auto& cb : e.callbacks)
+                    cb(true, std::string());
+                continue;
+            }
+            
+            if (!$fnPost(e.key, mc))
+            {
+                mc.clear();
+                for (auto& cb : e.callbacks)
+                    cb(false, "Request failed.");
+                continue;
+            }
+            
+            // the edits point into the entity, so it must have been serialized
+            mc.clear();
+            posted_++;
+            inflight.push_back(std::move(e.callbacks));
+        }
+    }
+
+public:
+    WriteQueue() {}
+    WriteQueue(const WriteQueue&) = delete;
+    WriteQueue& operator=(const WriteQueue&) = delete;
+    
+    bool empty()
+    {
+        return pending.empty();
+    }
+    size_t size()
+    {
+        return pending.size();
+    }
+    size_t inflightCount()
+    {
+        return inflight.size();
+    }
+    /**
+     * Edits added, requests posted, and entities dropped because their edits cancelled out.
+     */
+    uint64_t editCount()
+    {
+        return edits_;
+    }
+    uint64_t postCount()
+    {
+        return posted_;
+    }
+    uint64_t dropCount()
+    {
+        return dropped_;
+    }
+    
+    /**
+     * Takes the edits of mc (it is cleared). cb is called once the merged request completes
+     * (ok without a request if the edits cancelled out).
+     */
+    void add(const std::string& key, MultiCAS& mc, Callback cb = nullptr)
+    {
+        scratch.clear();
+        mc.visit(*this);
+        mc.clear();
+        
+        int64_t now = util::CoarseClock::shared().now();
+        auto it = index.find(key);
+        if (it == index.end())
+        {
+            it = index.emplace(key, pending.size()).first;
+            pending.emplace_back();
+            pending.back().key = key;
+            pending.back().first_ms = now;
+        }
+        
+        Entity& e = pending[it->second];
+        e.last_ms = now;
+        if (cb)
+            e.callbacks.push_back(std::move(cb));
+        
+        // oldest first
+        for (auto edit = scratch.rbegin(); edit != scratch.rend(); ++edit)
+            merge(e, *edit);
+        
+        edits_ += scratch.size();
+        
+        if (pending.size() >= max_pending)
+            flushDue(pending.size() - max_pending + 1);
+        else
+            schedule(debounce_ms);
+    }
+    
+    /**
+     * Posts every pending entity now, due or not (e.g before the screen closes).
+     */
+    void flush()
+    {
+        std::deque<Entity> list;
+        list.swap(pending);
+        index.clear();
+        
+        // callbacks may add edits
+        post(list);
+    }
+    
+    /**
+     * Completes the oldest inflight request. Returns false if there was none.
+     */
+    bool onResponse(bool ok, const std::string& errmsg)
+    {
+        if (inflight.empty())
+            return false;
+        
+        std::vector<Callback> callbacks(std::move(inflight.front()));
+        inflight.pop_front();
+        for (auto& cb : callbacks)
+            cb(ok, errmsg);
+        
+        return true;
+    }
+    
+    /**
+     * Fails every request awaiting a response (e.g on close). Pending edits are kept for the next flush.
+     */
+    void fail(const char* msg)
+    {
+        std::string errmsg(msg);
+        for (; !inflight.empty(); inflight.pop_front())
+        {
+            for (auto& cb : inflight.front())
+                cb(false, errmsg);
+        }
+    }
+};
+
+} // rpc
+} // coreds
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <cstring>
+
+#include <zlib.h>
+
+namespace coreds {
+namespace zip {
+
+// 16x the 1MB receive buffer of an rpc connection
+static const size_t DEFAULT_MAX_OUTPUT = 16 * 1024 * 1024;
+
+/**
+ * Reusable gzip compressor (the z_stream is reset, not re-allocated, per call).
+ */
+struct Deflater
+{
+private:
+    z_stream zs;
+    bool ok{ false };
+
+public:
+    Deflater(int level = Z_DEFAULT_COMPRESSION)
+    {
+        std::memset(&zs, 0, sizeof(zs));
+        // 15 + 16: gzip wrapper
+        ok = Z_OK == deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+    ~Deflater()
+    {
+        if (ok)
+            deflateEnd(&zs);
+    }
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+    
+    /**
+     * Replaces the contents of out with the compressed data.
+     */
+    bool compress(std::string& out, const char* data, size_t len)
+    {
+        if (!ok || Z_OK != deflateReset(&zs))
+            return false;
+        
+        out.resize(deflateBound(&zs, len));
+        
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = len;
+        zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        zs.avail_out = out.size();
+        
+        if (Z_STREAM_END != deflate(&zs, Z_FINISH))
+            return false;
+        
+        out.resize(zs.total_out);
+        return true;
+    }
+};
+
+/**
+ * Reusable gzip/deflate decompressor.
+ * Accepts gzip, zlib and raw deflate (some servers send the latter for Content-Encoding: deflate).
+ * Fails once the output would exceed max_output, so a small body cannot inflate without bound.
+ */
+struct Inflater
+{
+    size_t max_output;
+
+private:
+    z_stream zs;
+    z_stream raw;
+    bool ok{ false };
+    bool raw_ok{ false };
+    
+    static bool run(z_stream& s, std::string& out, const char* data, size_t len, size_t max)
+    {
+        size_t offset = 0;
+        int ret;
+        
+        if (out.size() < len * 4 + 64)
+            out.resize(std::min(len * 4 + 64, max));
+        
+        s.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        s.avail_in = len;
+        
+        for (;;)
+        {
+            size_t avail = std::min(out.size(), max) - offset;
+            s.next_out = reinterpret_cast<Bytef*>(&out[offset]);
+            s.avail_out = avail;
+            
+            ret = inflate(&s, Z_NO_FLUSH);
+            offset += avail - s.avail_out;
+            
+            if (Z_STREAM_END == ret)
+                break;
+            
+            if (Z_OK != ret && Z_BUF_ERROR != ret)
+                return false;
+            
+            if (s.avail_out != 0)
+            {
+                // truncated input
+                return false;
+            }
+            
+            if (offset >= max)
+                return false;
+            
+            out.resize(std::min(out.size() * 2, max));
+        }
+        
+        out.resize(offset);
+        return true;
+    }
+
+public:
+    Inflater(size_t max_output = DEFAULT_MAX_OUTPUT) : max_output(max_output)
+    {
+        std::memset(&zs, 0, sizeof(zs));
+        std::memset(&raw, 0, sizeof(raw));
+        // 15 + 32: auto-detect gzip/zlib
+        ok = Z_OK == inflateInit2(&zs, 15 + 32);
+        raw_ok = Z_OK == inflateInit2(&raw, -15);
+    }
+    ~Inflater()
+    {
+        if (ok)
+            inflateEnd(&zs);
+        if (raw_ok)
+            inflateEnd(&raw);
+    }
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+    
+    /**
+     * Replaces the contents of out with the decompressed data.
+     * The capacity of out is kept so it can be reused across calls.
+     * Returns false if the data is invalid or inflates to more than max_output.
+     */
+    bool decompress(std::string& out, const char* data, size_t len)
+    {
+        if (ok && Z_OK == inflateReset(&zs) && run(zs, out, data, len, max_output))
+            return true;
+        
+        return raw_ok && Z_OK == inflateReset(&raw) && run(raw, out, data, len, max_output);
+    }
+};
+
+} // zip
+} // coreds
@@ -0,0 +1,252 @@
+// rpc::Batch against a local stand-in batch endpoint: the length-prefixed framing of the response,
+// the order of the results (within and across batches) and the isolation of per-call errors.
+
+#include <mutex>
+#include <vector>
+
+#include <coreds/batch.h>
+
+#include "test.h"
+
+using namespace coreds;
+
+namespace {
+
+const char* const SCHEMA = R"(
+table Item {
+  key: string;
+  ts: long;
+  title: string;
+}
+table Item_PList {
+  p: [Item];
+}
+)";
+
+const char* const ROOT = "Item_PList";
+
+/**
+ * The envelope a standalone call to uri would get.
+ */
+std::string answer(const std::string& uri)
+{
+    if (uri == "/ok")
+        return R"(+[0,{"1":[{"1":"AAAAAAAAAAAA","2":1,"3":"x"}]}])";
+    if (uri == "/empty")
+        return R"(+[0,{"1":[]}])";
+    if (uri == "/denied")
+        return "-Denied.";
+    
+    // cut short
+    return R"(+[0,{"1":[)";
+}
+
+/**
+ * /batch answers each call of [{"1":"/uri","2":{...}},...] in order, as length\npart.
+ * /batch/rejected rejects the batch itself, /batch/short leaves out the last part.
+ */
+std::string handle(const std::string& uri, const std::string& body)
+{
+    if (uri == "/batch/rejected")
+        return "-Batch rejected.";
+    
+    std::vector<std::string> parts;
+    const std::string prefix(R"({"1":")");
+    for (size_t pos = 0; std::string::npos != (pos = body.find(prefix, pos));)
+    {
+        pos += prefix.size();
+        size_t end = body.find('"', pos);
+        parts.push_back(answer(body.substr(pos, end - pos)));
+        pos = end;
+    }
+    
+    if (uri == "/batch/short")
+        parts.pop_back();
+    
+    std::string res;
+    for (auto& part : parts)
+    {
+        res += std::to_string(part.size());
+        res += '\n';
+        res += part;
+    }
+    return res;
+}
+
+struct Result
+{
+    std::string uri;
+    bool ok;
+    std::string errmsg;
+    // the size of the flatbuffer built for it
+    size_t size;
+};
+
+struct Fixture
+{
+    test::Client client;
+    rpc::Batch batch;
+    std::mutex mutex;
+    std::vector<Result> results;
+    
+    Fixture(int port, const char* uri) : client(port), batch(uri, client.parser)
+    {
+        batch.$fnPost = [this](const std::string& uri, const std::string& body) {
+            return client.post(client.session, uri, body);
+        };
+        batch.$fnCall = [this](std::function<void()> op) {
+            client.queue(std::move(op));
+        };
+        client.$onData = [this](const brynet::net::HTTPParser& httpParser) {
+            batch.onResponse(client.readBody(httpParser));
+        };
+        client.$onClose = [this]() {
+            batch.fail("Connection closed.");
+        };
+    }
+    
+    ~Fixture()
+    {
+        client.stop();
+    }
+    
+    bool run()
+    {
+        return client.parser.Parse(SCHEMA) && client.run();
+    }
+    
+    void add(const char* uri)
+    {
+        batch.add(uri, R"({"1":true,"2":10})", ROOT, [this, uri](bool ok, flatbuffers::Parser& parser, const std::string& errmsg) {
+            std::lock_guard<std::mutex> lock(mutex);
+            results.push_back({ uri, ok, errmsg, ok ? parser.builder_.GetSize() : 0 });
+        });
+    }
+    
+    /**
+     * Adds the calls in one burst and waits for their results.
+     */
+    std::vector<Result> send(std::vector<const char*> uris)
+    {
+        client.call([this, &uris]() {
+            for (auto uri : uris)
+                add(uri);
+        });
+        
+        test::waitFor([this, &uris]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return results.size() >= uris.size();
+        });
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Result> list;
+        list.swap(results);
+        return list;
+    }
+};
+
+void testOrderAndIsolation(int port)
+{
+    Fixture f(port, "/batch");
+    if (!CHECK(f.run()))
+        return;
+    
+    auto results = f.send({ "/ok", "/denied", "/bad", "/empty", "/ok" });
+    if (!CHECK(results.size() == 5))
+        return;
+    
+    const char* order[] = { "/ok", "/denied", "/bad", "/empty", "/ok" };
+    for (size_t i = 0; i < 5; i++)
+        CHECK(results[i].uri == order[i]);
+    
+    CHECK(results[0].ok && results[0].size != 0);
+    CHECK(!results[1].ok && results[1].errmsg == "Denied.");
+    CHECK(!results[2].ok && results[2].errmsg == rpc::MALFORMED_MESSAGE);
+    CHECK(results[3].ok);
+    CHECK(results[4].ok && results[4].size == results[0].size);
+    CHECK(f.batch.inflightCount() == 0);
+}
+
+void testSplitBatches(int port)
+{
+    Fixture f(port, "/batch");
+    if (!CHECK(f.run()))
+        return;
+    
+    // 3 exchanges, pipelined on one connection
+    f.batch.max_calls = 2;
+    auto results = f.send({ "/ok", "/denied", "/empty", "/ok", "/denied" });
+    if (!CHECK(results.size() == 5))
+        return;
+    
+    const char* order[] = { "/ok", "/denied", "/empty", "/ok", "/denied" };
+    for (size_t i = 0; i < 5; i++)
+        CHECK(results[i].uri == order[i] && results[i].ok == (order[i][1] != 'd'));
+}
+
+void testMissingPart(int port)
+{
+    Fixture f(port, "/batch/short");
+    if (!CHECK(f.run()))
+        return;
+    
+    auto results = f.send({ "/ok", "/empty", "/ok" });
+    if (!CHECK(results.size() == 3))
+        return;
+    
+    CHECK(results[0].ok && results[1].ok);
+    CHECK(!results[2].ok && results[2].errmsg == rpc::MALFORMED_MESSAGE);
+}
+
+void testRejected(int port)
+{
+    Fixture f(port, "/batch/rejected");
+    if (!CHECK(f.run()))
+        return;
+    
+    auto results = f.send({ "/ok", "/empty" });
+    if (!CHECK(results.size() == 2))
+        return;
+    
+    for (auto& r : results)
+        CHECK(!r.ok && r.errmsg == "Batch rejected.");
+}
+
+void testNotSent(int port)
+{
+    Fixture f(port, "/batch");
+    if (!CHECK(f.run()))
+        return;
+    
+    // dropped by post (no session), failed right away
+    f.client.call([&f]() {
+        f.client.session = nullptr;
+    });
+    auto results = f.send({ "/ok", "/empty" });
+    if (!CHECK(results.size() == 2))
+        return;
+    
+    for (auto& r : results)
+        CHECK(!r.ok && r.errmsg == "Request failed.");
+}
+
+} // namespace
+
+int main()
+{
+    bench::StandinServer::Options opts;
+    opts.handler = handle;
+    
+    bench::StandinServer server(opts);
+    if (!CHECK(server.start()))
+        return test::result("batch_test");
+    
+    testOrderAndIsolation(server.port());
+    testSplitBatches(server.port());
+    testMissingPart(server.port());
+    testRejected(server.port());
+    testNotSent(server.port());
+    
+    server.stop();
+    return test::result("batch_test");
+}
@@ -0,0 +1,203 @@
+// rpc::Limiter wired into rpc::Base, against local stand-in servers with injected latency:
+// the limit adapts to the response latency, excess work is shed, interactive work goes first,
+// and every slot is released (responses, dropped connections).
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "test.h"
+
+using namespace coreds;
+
+namespace {
+
+const char* const URI = "/test/Item/list";
+const char* const REQ_BODY = R"({"1":true,"2":10})";
+
+struct Fixture
+{
+    test::Client client;
+    rpc::Limiter limiter;
+    // loop only: the tags of the requests awaiting a response, in order
+    std::deque<int> pending;
+    std::mutex mutex;
+    std::vector<int> completed;
+    std::vector<int> failed;
+    std::atomic<int> shed{ 0 };
+    std::atomic<int> inflight_max{ 0 };
+    
+    Fixture(int port, double initial_limit) : client(port), limiter(initial_limit)
+    {
+        client.limiter = &limiter;
+        client.$onData = [this](const brynet::net::HTTPParser& httpParser) {
+            std::lock_guard<std::mutex> lock(mutex);
+            (httpParser.getStatusCode() == 200 ? completed : failed).push_back(pending.front());
+            pending.pop_front();
+        };
+        client.$onClose = [this]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int tag : pending)
+                failed.push_back(tag);
+            pending.clear();
+        };
+    }
+    
+    ~Fixture()
+    {
+        client.stop();
+    }
+    
+    /**
+     * Loop only.
+     */
+    void submit(rpc::Priority priority, int tag)
+    {
+        client.submit(priority, [this, tag]() {
+            if (!client.post(client.session, URI, REQ_BODY))
+                return false;
+            
+            pending.push_back(tag);
+            if (limiter.inflight() > inflight_max)
+                inflight_max = limiter.inflight();
+            return true;
+        }, [this](const char* errmsg) {
+            if (errmsg == rpc::OVERLOADED_MESSAGE)
+                shed++;
+        });
+    }
+    
+    size_t done()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return completed.size() + failed.size();
+    }
+    
+    int inflight()
+    {
+        int value;
+        client.call([this, &value]() {
+            value = limiter.inflight();
+        });
+        return value;
+    }
+};
+
+void testGrowsWhenFast(int port)
+{
+    Fixture f(port, 4);
+    f.limiter.target_ms = 1000;
+    if (!CHECK(f.client.run()))
+        return;
+    
+    // waves of 50, each submitted in one burst
+    for (int wave = 0, tag = 0; wave < 4; wave++)
+    {
+        f.client.call([&f, &tag]() {
+            for (int i = 0; i < 50; i++)
+                f.submit(rpc::Priority::INTERACTIVE, tag++);
+        });
+        test::waitFor([&f, wave]() { return f.done() == static_cast<size_t>(50 * (wave + 1)); });
+    }
+    
+    CHECK(f.done() == 200);
+    CHECK(f.failed.empty());
+    CHECK(f.shed == 0);
+    CHECK(f.limiter.limit() > 4);
+    CHECK(f.inflight() == 0);
+    
+    // in order
+    for (size_t i = 0; i < f.completed.size(); i++)
+        CHECK(f.completed[i] == static_cast<int>(i));
+}
+
+void testShrinksAndShedsWhenSlow(int port)
+{
+    Fixture f(port, 8);
+    f.limiter.target_ms = 5;
+    f.limiter.backoff = 0.5;
+    f.limiter.max_queue[0] = 4;
+    if (!CHECK(f.client.run()))
+        return;
+    
+    // 8 sent, 4 queued, 4 shed
+    f.client.call([&f]() {
+        for (int i = 0; i < 16; i++)
+            f.submit(rpc::Priority::INTERACTIVE, i);
+    });
+    CHECK(test::waitFor([&f]() { return f.done() == 12; }));
+    
+    CHECK(f.shed == 4);
+    CHECK(f.failed.empty());
+    CHECK(f.inflight_max <= 8);
+    // every response took longer than the target
+    CHECK(f.limiter.limit() == f.limiter.min_limit);
+    CHECK(f.inflight() == 0);
+}
+
+void testInteractiveFirst(int port)
+{
+    Fixture f(port, 1);
+    f.limiter.min_limit = 1;
+    f.limiter.max_limit = 1;
+    if (!CHECK(f.client.run()))
+        return;
+    
+    // 0 is sent, the rest waits for it
+    f.client.call([&f]() {
+        f.submit(rpc::Priority::BACKGROUND, 0);
+        f.submit(rpc::Priority::BACKGROUND, 1);
+        f.submit(rpc::Priority::BACKGROUND, 2);
+        f.submit(rpc::Priority::INTERACTIVE, 3);
+        f.submit(rpc::Priority::INTERACTIVE, 4);
+    });
+    CHECK(test::waitFor([&f]() { return f.done() == 5; }));
+    
+    std::vector<int> expected{ 0, 3, 4, 1, 2 };
+    CHECK(f.completed == expected);
+    CHECK(f.inflight_max == 1);
+}
+
+void testReleasedOnClose(int port)
+{
+    Fixture f(port, 8);
+    if (!CHECK(f.client.run()))
+        return;
+    
+    // the connection drops at the 3rd, nothing is answered after it
+    f.client.call([&f]() {
+        for (int i = 0; i < 6; i++)
+            f.submit(rpc::Priority::INTERACTIVE, i);
+    });
+    CHECK(test::waitFor([&f]() { return f.done() == 6; }));
+    CHECK(test::waitFor([&f]() { return f.client.closed != 0; }));
+    
+    CHECK(f.completed.size() == 2);
+    CHECK(f.inflight() == 0);
+}
+
+} // namespace
+
+int main()
+{
+    bench::StandinServer::Options fast_opts;
+    bench::StandinServer fast(fast_opts);
+    
+    bench::StandinServer::Options slow_opts;
+    slow_opts.delay_ms = 20;
+    bench::StandinServer slow(slow_opts);
+    
+    bench::StandinServer::Options drop_opts;
+    drop_opts.drop_every = 3;
+    bench::StandinServer drop(drop_opts);
+    
+    if (!CHECK(fast.start() && slow.start() && drop.start()))
+        return test::result("limiter_test");
+    
+    testGrowsWhenFast(fast.port());
+    testShrinksAndShedsWhenSlow(slow.port());
+    testInteractiveFirst(slow.port());
+    testReleasedOnClose(drop.port());
+    
+    return test::result("limiter_test");
+}
@@ -0,0 +1,110 @@
+// rpc::Base auto-reconnect against a local stand-in server that drops the connection mid-response:
+// the idempotent requests in flight are replayed in order (before those queued while disconnected),
+// and a non-idempotent one is failed instead.
+
+#include <mutex>
+#include <vector>
+
+#include "test.h"
+
+using namespace coreds;
+
+namespace {
+
+const char* const URI = "/test/echo";
+
+std::string echo(const std::string&, const std::string& body)
+{
+    return "+[0," + body + "]";
+}
+
+std::string bodyOf(int i)
+{
+    return "{\"1\":" + std::to_string(i) + "}";
+}
+
+struct Fixture
+{
+    test::Client client;
+    std::mutex mutex;
+    std::vector<std::string> received;
+    std::atomic<int> timeouts{ 0 };
+    std::atomic<int> queued{ 0 };
+    
+    Fixture(int port) : client(port)
+    {
+        client.auto_reconnect = true;
+        client.reconnect_min_ms = 10;
+        client.$onData = [this](const brynet::net::HTTPParser& httpParser) {
+            std::string& body = client.readBody(httpParser);
+            std::lock_guard<std::mutex> lock(mutex);
+            // +[0,...]
+            received.push_back(body.substr(4, body.size() - 5));
+        };
+        client.$onClose = [this]() {
+            // no session: queued, sent after those in flight
+            if (client.post(client.session, URI, bodyOf(6), true))
+                queued++;
+        };
+    }
+    
+    ~Fixture()
+    {
+        client.stop();
+    }
+    
+    size_t count()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return received.size();
+    }
+};
+
+void testReplayOrder(int port)
+{
+    Fixture f(port);
+    if (!CHECK(f.client.run()))
+        return;
+    
+    // the server answers 3, then drops the connection halfway through the 4th response
+    f.client.call([&f]() {
+        for (int i = 0; i < 4; i++)
+            f.client.post(f.client.session, URI, bodyOf(i), true);
+        
+        // not idempotent: failed on close, not replayed
+        f.client.postWithin(f.client.session, URI, bodyOf(4), 5000, nullptr, [&f]() {
+            f.timeouts++;
+        });
+        
+        f.client.post(f.client.session, URI, bodyOf(5), true);
+    });
+    
+    CHECK(test::waitFor([&f]() { return f.count() == 6; }));
+    CHECK(f.client.opened == 2);
+    CHECK(f.client.closed == 1);
+    CHECK(f.queued == 1);
+    CHECK(f.timeouts == 1);
+    
+    std::vector<std::string> expected{ bodyOf(0), bodyOf(1), bodyOf(2), bodyOf(3), bodyOf(5), bodyOf(6) };
+    std::lock_guard<std::mutex> lock(f.mutex);
+    CHECK(f.received == expected);
+}
+
+} // namespace
+
+int main()
+{
+    bench::StandinServer::Options opts;
+    opts.handler = echo;
+    opts.drop_every = 4;
+    opts.drop_partial = true;
+    
+    bench::StandinServer server(opts);
+    if (!CHECK(server.start()))
+        return test::result("reconnect_test");
+    
+    testReplayOrder(server.port());
+    
+    CHECK(server.dropCount() == 1);
+    return test::result("reconnect_test");
+}
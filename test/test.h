@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <coreds/rpc.h>
+
+#include "../bench/standin.h"
+
+namespace coreds {
+namespace test {
+
+/**
+ * The number of failed checks so far (checks only run on the main thread).
+ */
+inline int& failures()
+{
+    static int count = 0;
+    return count;
+}
+
+inline bool check(bool ok, const char* expr, const char* file, int line)
+{
+    if (!ok)
+    {
+        failures()++;
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    }
+    return ok;
+}
+
+#define CHECK(expr) coreds::test::check((expr), #expr, __FILE__, __LINE__)
+
+/**
+ * Polls until done() or timeout_ms elapsed. Returns done().
+ */
+inline bool waitFor(const std::function<bool()>& done, int timeout_ms = 5000)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!done())
+    {
+        if (std::chrono::steady_clock::now() >= until)
+            return done();
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/**
+ * Prints the outcome and returns the exit code.
+ */
+inline int result(const char* name)
+{
+    if (failures() == 0)
+        std::printf("%s: ok\n", name);
+    else
+        std::printf("%s: %d failed\n", name, failures());
+    
+    return failures() == 0 ? 0 : 1;
+}
+
+/**
+ * rpc::Base connected to a local stand-in server, with its callbacks as hooks.
+ * Apart from construction and run(), everything must happen on its loop (see call()).
+ */
+struct Client : rpc::Base
+{
+    std::function<void(const brynet::net::HTTPParser& httpParser)> $onData;
+    std::function<void()> $onOpen;
+    std::function<void()> $onClose;
+    
+    brynet::net::HttpSession::PTR session;
+    std::atomic<int> opened{ 0 };
+    std::atomic<int> closed{ 0 };
+    
+    using rpc::Base::post;
+    using rpc::Base::postWithin;
+    using rpc::Base::submit;
+    using rpc::Base::readBody;
+    using rpc::Base::parseBody;
+    
+    Client(int port) : rpc::Base({ "127.0.0.1", port, false }) {}
+    
+    ~Client()
+    {
+        // before the hooks and their owners go away
+        stop();
+    }
+    
+    /**
+     * Starts the loop and connects, waiting for the session to open.
+     */
+    bool run()
+    {
+        start();
+        return connect() && waitFor([this]() { return opened != 0; });
+    }
+    
+    /**
+     * Runs fn on the loop and waits for it.
+     */
+    void call(std::function<void()> fn)
+    {
+        std::atomic<bool> done{ false };
+        queue([&fn, &done]() {
+            fn();
+            done = true;
+        });
+        
+        // no timeout: fn and done must outlive the task
+        while (!done)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    void onLoop(const brynet::net::EventLoop::PTR&) override
+    {
+        // idle
+    }
+    
+    void onHttpOpen(const brynet::net::HttpSession::PTR& session) override
+    {
+        this->session = session;
+        if ($onOpen)
+            $onOpen();
+        opened++;
+    }
+    
+    void onHttpData(const brynet::net::HTTPParser& httpParser, const brynet::net::HttpSession::PTR&) override
+    {
+        if ($onData)
+            $onData(httpParser);
+    }
+    
+    void onHttpClose(const brynet::net::HttpSession::PTR&) override
+    {
+        session = nullptr;
+        if ($onClose)
+            $onClose();
+        closed++;
+    }
+};
+
+} // test
+} // coreds